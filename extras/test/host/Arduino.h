@@ -0,0 +1,94 @@
+#pragma once
+#ifndef CTBOT_HOST_ARDUINO
+#define CTBOT_HOST_ARDUINO
+
+// minimal Arduino core for the host tests: only what the board independent classes use
+// (String, Stream/Print, millis, delay). It is not part of the library
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <string>
+#include <chrono>
+#include <thread>
+
+typedef uint8_t byte;
+
+class String
+{
+public:
+	String() {}
+	String(const char* text) : m_text(text != NULL ? text : "") {}
+	String(const std::string& text) : m_text(text) {}
+	String(char c) : m_text(1, c) {}
+	String(int value) : m_text(std::to_string(value)) {}
+	String(unsigned int value) : m_text(std::to_string(value)) {}
+	String(long value) : m_text(std::to_string(value)) {}
+	String(unsigned long value) : m_text(std::to_string(value)) {}
+
+	unsigned int length(void) const { return(m_text.length()); }
+	const char* c_str(void) const { return(m_text.c_str()); }
+	bool reserve(unsigned int size) { m_text.reserve(size); return true; }
+
+	int indexOf(char c, unsigned int from = 0) const { return(find(m_text.find(c, from))); }
+	int indexOf(const String& text, unsigned int from = 0) const { return(find(m_text.find(text.m_text, from))); }
+	String substring(unsigned int from) const { return(from < length() ? m_text.substr(from) : ""); }
+	String substring(unsigned int from, unsigned int to) const {
+		return(from < to && from < length() ? m_text.substr(from, to - from) : "");
+	}
+	bool startsWith(const String& text) const { return(m_text.compare(0, text.length(), text.m_text) == 0); }
+	long toInt(void) const { return(strtol(m_text.c_str(), NULL, 10)); }
+
+	void toLowerCase(void) {
+		for (size_t i = 0; i < m_text.length(); i++)
+			m_text[i] = tolower((unsigned char)m_text[i]);
+	}
+	void toUpperCase(void) {
+		for (size_t i = 0; i < m_text.length(); i++)
+			m_text[i] = toupper((unsigned char)m_text[i]);
+	}
+	void trim(void) {
+		size_t first = m_text.find_first_not_of(" \t\r\n");
+		size_t last  = m_text.find_last_not_of(" \t\r\n");
+		m_text = (first == std::string::npos) ? "" : m_text.substr(first, last - first + 1);
+	}
+
+	char operator[](unsigned int index) const { return(index < length() ? m_text[index] : 0); }
+	String& operator+=(const String& text) { m_text += text.m_text; return(*this); }
+	String& operator+=(char c) { m_text += c; return(*this); }
+	friend String operator+(const String& a, const String& b) { return(String(a.m_text + b.m_text)); }
+	friend bool operator==(const String& a, const String& b) { return(a.m_text == b.m_text); }
+	friend bool operator!=(const String& a, const String& b) { return(a.m_text != b.m_text); }
+
+private:
+	std::string m_text;
+
+	static int find(size_t position) { return(position == std::string::npos ? -1 : (int)position); }
+};
+
+class Print
+{
+public:
+	virtual ~Print() {}
+	virtual size_t write(const uint8_t* buffer, size_t size) = 0;
+	size_t print(const String& text) { return(write((const uint8_t*)text.c_str(), text.length())); }
+};
+
+class Stream : public Print
+{
+public:
+	// next byte, -1 if none available now
+	virtual int read(void) = 0;
+	virtual int available(void) = 0;
+};
+
+inline unsigned long millis(void) {
+	static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	return((unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+inline void delay(unsigned long ms) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+#endif
@@ -0,0 +1,85 @@
+// host test of the lock free single producer / single consumer queue used by CTBotBackground:
+// the queue semantics on a single thread, then a producer and a consumer thread moving items in order.
+// Build it with -fsanitize=thread to check the memory ordering too
+
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include "CTBotSPSCQueue.h"
+
+static int failures = 0;
+
+static void check(const char* name, bool passed) {
+	printf("%s %s\n", passed ? "ok  " : "FAIL", name);
+	if (!passed)
+		failures++;
+}
+
+static void testSingleThread(void) {
+	CTBotSPSCQueue<uint32_t, 4> queue;
+	uint32_t item;
+	check("empty queue", queue.isEmpty() && !queue.isFull() && (0 == queue.getCount()) && !queue.pop(item));
+
+	bool pushed = true;
+	for (uint32_t i = 0; i < 4; i++)
+		pushed = pushed && queue.push(i);
+	check("push up to the size", pushed && queue.isFull() && (4 == queue.getCount()));
+	check("push on a full queue", !queue.push(99) && (4 == queue.getCount()));
+
+	// wrap around the ring a few times, keeping it half full
+	bool ordered = true;
+	uint32_t next = 0;
+	for (uint32_t i = 4; i < 20; i++) {
+		ordered = ordered && queue.pop(item) && (item == next++);
+		ordered = ordered && queue.push(i) && (4 == queue.getCount());
+	}
+	while (queue.pop(item))
+		ordered = ordered && (item == next++);
+	check("FIFO order across the wrap", ordered && (20 == next) && queue.isEmpty());
+}
+
+template <typename T>
+static void testThreads(const char* name, uint32_t count, T (*make)(uint32_t)) {
+	CTBotSPSCQueue<T, 8> queue;
+	uint32_t misplaced = 0;
+
+	std::thread producer([&]() {
+		for (uint32_t i = 0; i < count; ) {
+			if (queue.push(make(i)))
+				i++;
+			else
+				std::this_thread::yield();
+		}
+	});
+	std::thread consumer([&]() {
+		T item;
+		for (uint32_t i = 0; i < count; ) {
+			if (queue.pop(item)) {
+				if (!(item == make(i)))
+					misplaced++;
+				i++;
+			}
+			else
+				std::this_thread::yield();
+		}
+	});
+	producer.join();
+	consumer.join();
+	check(name, (0 == misplaced) && queue.isEmpty());
+}
+
+static uint32_t makeNumber(uint32_t i) {
+	return(i);
+}
+
+static std::string makeText(uint32_t i) {
+	// long enough to live on the heap, like the queued message Strings
+	return("update " + std::to_string(i) + std::string(32, 'x'));
+}
+
+int main(void) {
+	testSingleThread();
+	testThreads<uint32_t>("two threads, numbers", 200000, makeNumber);
+	testThreads<std::string>("two threads, heap strings", 50000, makeText);
+	return(failures ? 1 : 0);
+}
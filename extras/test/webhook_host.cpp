@@ -0,0 +1,106 @@
+// host build of the webhook request handler: a TCP listener on the loopback interface that hands every
+// connection to CTBotWebhookHandler::handleRequest(), like CTBotWebhook::handleClient() does on the board.
+// Usage: webhook_host <port> <path> <secret | ""> <requests>
+// After <requests> connections it prints the counters and the queued updates (one per line) and exits
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "CTBotWebhookHandler.h"
+
+// a connected socket as a non blocking Arduino Stream
+class SocketStream : public Stream
+{
+public:
+	explicit SocketStream(int fd) : m_fd(fd) {
+		fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) | O_NONBLOCK);
+	}
+
+	int read(void) override {
+		uint8_t c;
+		return(recv(m_fd, &c, 1, 0) == 1 ? c : -1);
+	}
+
+	int available(void) override {
+		uint8_t c;
+		return(recv(m_fd, &c, 1, MSG_PEEK) == 1 ? 1 : 0);
+	}
+
+	size_t write(const uint8_t* buffer, size_t size) override {
+		size_t sent = 0;
+		while (sent < size) {
+			ssize_t n = send(m_fd, buffer + sent, size - sent, MSG_NOSIGNAL);
+			if (n > 0)
+				sent += n;
+			else if ((n < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK))
+				break;
+		}
+		return(sent);
+	}
+
+	// close like a server that lingers: the unread request body (a refused request) is drained,
+	// otherwise the client gets a reset instead of the response
+	void close(void) {
+		shutdown(m_fd, SHUT_WR);
+		uint32_t deadline = millis() + 1000;
+		while ((int32_t)(millis() - deadline) < 0) {
+			uint8_t buffer[256];
+			ssize_t n = recv(m_fd, buffer, sizeof(buffer), 0);
+			if (0 == n)
+				break;
+			if (n < 0)
+				delay(1);
+		}
+		::close(m_fd);
+	}
+
+private:
+	int m_fd;
+};
+
+int main(int argc, char* argv[]) {
+	if (argc != 5) {
+		fprintf(stderr, "usage: %s <port> <path> <secret> <requests>\n", argv[0]);
+		return 2;
+	}
+
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	int enable = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family      = AF_INET;
+	address.sin_port        = htons(atoi(argv[1]));
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if ((bind(listener, (sockaddr*)&address, sizeof(address)) != 0) || (listen(listener, 4) != 0)) {
+		perror("listen");
+		return 2;
+	}
+	printf("listening\n");
+	fflush(stdout);
+
+	CTBotWebhookHandler handler;
+	handler.begin(argv[2], argv[3]);
+	for (int requests = atoi(argv[4]); requests > 0; requests--) {
+		int fd = accept(listener, NULL, NULL);
+		if (fd < 0) {
+			perror("accept");
+			return 2;
+		}
+		SocketStream client(fd);
+		handler.handleRequest(client);
+		client.close();
+	}
+	close(listener);
+
+	printf("received %u rejected %u\n", (unsigned)handler.getReceived(), (unsigned)handler.getRejected());
+	String update;
+	while (handler.pop(update))
+		printf("%s\n", update.c_str());
+	return 0;
+}
@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+"""
+Replay the recorded updates (updates.json) to the host build of the webhook
+request handler (webhook_host) and check the HTTP status codes and the
+queued updates.
+
+Usage:
+    webhook_test.py <webhook_host binary>
+"""
+import json
+import os
+import socket
+import subprocess
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, "..", "webhookReplay"))
+from ctbot_webhook_replay import load_updates, post  # noqa: E402
+
+QUEUE_SIZE = 4  # CTBOT_WEBHOOK_QUEUE_SIZE
+
+
+def free_port():
+    with socket.socket() as probe:
+        probe.bind(("127.0.0.1", 0))
+        return probe.getsockname()[1]
+
+
+def run(binary, path, secret, requests):
+    """post the requests ((path, update, secret) tuples), return the status codes and the host output"""
+    port = free_port()
+    host = subprocess.Popen([binary, str(port), path, secret, str(len(requests))],
+                            stdout=subprocess.PIPE, text=True)
+    host.stdout.readline()  # "listening"
+    codes = [post("http://127.0.0.1:%d%s" % (port, request_path), update, request_secret)
+             for request_path, update, request_secret in requests]
+    output, _ = host.communicate(timeout=10)
+    lines = output.splitlines()
+    return codes, lines[0], [json.loads(line) for line in lines[1:]]
+
+
+def check(name, actual, expected):
+    if actual != expected:
+        print("FAIL %s: %r != %r" % (name, actual, expected))
+        return 1
+    print("ok   %s" % name)
+    return 0
+
+
+def main(argv):
+    if len(argv) != 2:
+        print(__doc__)
+        return 2
+    binary = argv[1]
+    updates = load_updates(os.path.join(HERE, "updates.json"))
+    failures = 0
+
+    # secret token: only the requests to the right path with the right header are queued
+    codes, counters, queued = run(binary, "/telegram", "s3cret", [
+        ("/telegram", updates[0], "s3cret"),
+        ("/telegram", updates[1], "wrong"),
+        ("/telegram", updates[2], None),
+        ("/other", updates[3], "s3cret"),
+        ("/telegram?x=1", updates[4], "s3cret"),
+    ])
+    failures += check("secret: status codes", codes, [200, 401, 401, 404, 200])
+    failures += check("secret: counters", counters, "received 2 rejected 3")
+    failures += check("secret: queued updates", queued, [updates[0], updates[4]])
+
+    # no secret token: the header is ignored
+    codes, counters, queued = run(binary, "/", "", [
+        ("/", updates[0], "anything"),
+        ("/", updates[1], None),
+    ])
+    failures += check("no secret: status codes", codes, [200, 200])
+    failures += check("no secret: queued updates", queued, updates[:2])
+
+    # full queue: refused with 503, the Telegram server sends the update again later
+    codes, counters, queued = run(binary, "/", "", [("/", update, None) for update in updates])
+    failures += check("full queue: status codes", codes, [200] * QUEUE_SIZE + [503] * (len(updates) - QUEUE_SIZE))
+    failures += check("full queue: queued updates", queued, updates[:QUEUE_SIZE])
+
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
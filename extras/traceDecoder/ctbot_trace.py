@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+"""
+Decode a CTBot trace dump (CTBot::dumpTrace()) into a timeline.
+
+Usage:
+    ctbot_trace.py <dump file>      (use - to read from the standard input)
+
+The dump can be embedded in other serial console output: the decoder looks
+for the "CTBT" magic and decodes every dump found.
+"""
+import struct
+import sys
+
+EVENTS = {
+    1:  "request start",
+    2:  "DNS start",
+    3:  "DNS end",
+    4:  "connect start",
+    5:  "connect end (TLS done)",
+    6:  "request sent",
+    7:  "first byte",
+    8:  "bytes read",
+    9:  "response end",
+    10: "request end",
+    11: "parse start",
+    12: "parse end",
+    13: "heap low-water",
+}
+
+API_METHODS = ["getMe", "getUpdates", "sendMessage", "editMessageText", "answerCallbackQuery", "other"]
+
+
+def describe(event, value):
+    if event == 1:
+        return API_METHODS[value] if value < len(API_METHODS) else str(value)
+    if event in (3, 5, 12):
+        return "ok" if value else "failed"
+    if event in (6, 8, 10):
+        return "%d bytes" % value
+    if event == 9:
+        return "HTTP %d" % value if value else "no response"
+    if event == 13:
+        return "%d bytes free" % value
+    return ""
+
+
+def decode(data, offset):
+    version, record_size, count = struct.unpack_from("<BBH", data, offset + 4)
+    if version != 1 or record_size != 8:
+        raise ValueError("unsupported trace version %d (record size %d)" % (version, record_size))
+    offset += 8
+    records = []
+    for _ in range(count):
+        timestamp, packed = struct.unpack_from("<II", data, offset)
+        records.append((timestamp, packed >> 24, packed & 0xFFFFFF))
+        offset += record_size
+    return records, offset
+
+
+def print_timeline(records):
+    if not records:
+        print("(empty trace)")
+        return
+    start = records[0][0]
+    previous = start
+    elapsed = 0
+    print("%12s %10s  %-24s %s" % ("time (us)", "delta", "event", "value"))
+    for timestamp, event, value in records:
+        # micros() wraps around every ~71 minutes: unsigned 32 bit deltas
+        delta = (timestamp - previous) & 0xFFFFFFFF
+        elapsed += delta
+        previous = timestamp
+        print("%12d %+10d  %-24s %s" % (elapsed, delta, EVENTS.get(event, "event %d" % event), describe(event, value)))
+
+
+def main():
+    if len(sys.argv) != 2:
+        print(__doc__.strip())
+        return 1
+    if sys.argv[1] == "-":
+        data = sys.stdin.buffer.read()
+    else:
+        with open(sys.argv[1], "rb") as dump:
+            data = dump.read()
+
+    offset = data.find(b"CTBT")
+    if offset < 0:
+        print("no trace found")
+        return 1
+    while offset >= 0:
+        records, end = decode(data, offset)
+        print_timeline(records)
+        offset = data.find(b"CTBT", end)
+        if offset >= 0:
+            print()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
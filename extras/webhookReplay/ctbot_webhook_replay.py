@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+"""
+Post recorded Telegram updates to a CTBot webhook receiver (CTBot::startWebhook()).
+
+Usage:
+    ctbot_webhook_replay.py <updates file> [url] [--secret <token>] [--delay <seconds>]
+
+The updates file can contain one update JSON object per line or whole
+getUpdates responses ({"ok":true,"result":[...]}), i.e. recorded with
+    curl https://api.telegram.org/bot<token>/getUpdates > updates.json
+The receiver runs on the board: the url is the board address, i.e.
+http://192.168.1.50:8080/telegram. The default url is http://127.0.0.1:8080/
+(the CTBOT_WEBHOOK_PORT default), for a port forwarded to the board.
+Every update is sent like the Telegram server does: a POST with a JSON
+body and the optional X-Telegram-Bot-Api-Secret-Token header.
+"""
+import json
+import sys
+import time
+import urllib.error
+import urllib.request
+
+
+def load_updates(path):
+    with (sys.stdin if path == "-" else open(path, encoding="utf-8")) as source:
+        text = source.read()
+    try:
+        documents = [json.loads(text)]
+    except ValueError:
+        documents = [json.loads(line) for line in text.splitlines() if line.strip()]
+    updates = []
+    for document in documents:
+        if isinstance(document, dict) and "result" in document:
+            updates.extend(document["result"])
+        elif isinstance(document, list):
+            updates.extend(document)
+        else:
+            updates.append(document)
+    return updates
+
+
+def post(url, update, secret):
+    body = json.dumps(update, ensure_ascii=False).encode("utf-8")
+    request = urllib.request.Request(url, data=body, method="POST")
+    request.add_header("Content-Type", "application/json")
+    if secret:
+        request.add_header("X-Telegram-Bot-Api-Secret-Token", secret)
+    try:
+        with urllib.request.urlopen(request, timeout=10) as response:
+            return response.status
+    except urllib.error.HTTPError as error:
+        return error.code
+    except OSError:
+        # the receiver closes the connection of a refused request without reading its body
+        return 0
+
+
+def main(argv):
+    args = argv[1:]
+    secret = None
+    pause = 0.0
+    if "--secret" in args:
+        i = args.index("--secret")
+        secret = args[i + 1]
+        del args[i:i + 2]
+    if "--delay" in args:
+        i = args.index("--delay")
+        pause = float(args[i + 1])
+        del args[i:i + 2]
+    if not args:
+        print(__doc__)
+        return 1
+    url = args[1] if len(args) > 1 else "http://127.0.0.1:8080/"
+
+    failures = 0
+    for update in load_updates(args[0]):
+        status = post(url, update, secret)
+        print("update %s -> HTTP %d" % (update.get("update_id", "?"), status))
+        if status != 200:
+            failures += 1
+        time.sleep(pause)
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -10,6 +10,7 @@
 #include <ArduinoJson.h>
 #include "CTBot.h"
 #include "Utilities.h"
+#include "CTBotTrace.h"
 
 
 CTBot::CTBot() {
@@ -18,19 +19,289 @@ CTBot::CTBot() {
 	m_lastUpdate          = 0;  // not updated yet
 	m_useDNS              = false; // use static IP for Telegram Server
 	m_UTF8Encoding        = false; // no UTF8 encoded string conversion
-	m_lastUpdateTimeStamp = millis();
+	m_serverTime          = 0; // clock not synchronized
+	m_serverTimeStamp     = 0;
+	m_lastStatus          = CTBotRequestOK;
+	memset(&m_broadcastStats, 0, sizeof(m_broadcastStats));
+	m_outboxTimeStamp     = millis() - CTBOT_OUTBOX_INTERVAL;
+	m_outboxInterval      = CTBOT_OUTBOX_INTERVAL;
 }
 
 CTBot::~CTBot() {
 }
 
-String CTBot::sendCommand(const String& command, const String& parameters)
+String CTBot::sendCommand(const String& command, const String& parameters, uint32_t timeout, bool discardBody)
 {
 	// must filter command + parameters from escape sequences and spaces
-	const String URL = (String)"GET https://api.telegram.org/bot" + m_token + (String)"/" + command + parameters;
+	const String path = (String)FSTR("/bot") + m_token + (String)"/" + command + parameters;
+
+	// every request is a wake window, also the ones sent by the sketch between two polls
+	CTBotWakeScope wakeScope(m_lowPower);
 
 	// send the HTTP request
-	return(m_connection.send(URL));
+	CTBotApiMethod method = CTBotMetrics::toApiMethod(command);
+	traceEvent(CTBotTraceRequestStart, method);
+	uint32_t startTime = millis();
+	String response = m_connection.send(path, timeout, discardBody);
+	endRequest(method, startTime, response.length() != 0);
+
+	return(response);
+}
+
+void CTBot::endRequest(CTBotApiMethod method, uint32_t startTime, bool received)
+{
+	const CTBotRequestStats& stats = m_connection.getLastRequestStats();
+	if (received)
+		m_lastStatus = CTBotRequestOK;
+	else if (stats.deadlineExpired || stats.timedOut)
+		m_lastStatus = CTBotRequestTimeout;
+	else
+		m_lastStatus = CTBotRequestNoConnection;
+	m_metrics.addRequest(method, millis() - startTime, received, stats);
+	traceEvent(CTBotTraceRequestEnd, stats.bytesIn);
+
+	syncServerTime(stats);
+}
+
+bool CTBot::sendBatch(CTBotBatch& batch, uint32_t timeout)
+{
+	String paths[CTBOT_MAX_BATCH_SIZE];
+	String responses[CTBOT_MAX_BATCH_SIZE];
+
+	if (0 == batch.m_count)
+		return true;
+
+	CTBotHeapScope heapScope(m_metrics, CTBotApiOther);
+	CTBotWakeScope wakeScope(m_lowPower);
+
+	for (uint8_t i = 0; i < batch.m_count; i++)
+		paths[i] = (String)FSTR("/bot") + m_token + (String)"/" + CTBotMetrics::toCommand(batch.m_method[i]) + batch.m_parameters[i];
+
+	// send the pipelined HTTP requests
+	traceEvent(CTBotTraceRequestStart, batch.m_method[0]);
+	uint32_t startTime = millis();
+	m_connection.sendBatch(paths, responses, batch.m_count, timeout, batch.m_discardResponses);
+	uint32_t elapsed = millis() - startTime;
+
+	const CTBotRequestStats& stats = m_connection.getLastRequestStats();
+	traceEvent(CTBotTraceRequestEnd, stats.bytesIn);
+	syncServerTime(stats);
+
+	CTBotRequestStats itemStats = stats;
+	m_lastStatus = CTBotRequestOK;
+	bool success = true;
+	for (uint8_t i = 0; i < batch.m_count; i++) {
+		// the connection phases and the bytes are accounted by the first request only
+		if (i > 0)
+			memset(&itemStats, 0, sizeof(itemStats));
+		itemStats.timedOut = stats.timedOut && (0 == responses[i].length());
+		m_metrics.addRequest(batch.m_method[i], elapsed, responses[i].length() != 0, itemStats);
+		batch.m_messageID[i]  = 0;
+		batch.m_status[i]     = CTBotRequestOK;
+		batch.m_errorCode[i]  = 0;
+		batch.m_retryAfter[i] = 0;
+
+		if (0 == responses[i].length())
+			batch.m_status[i] = (stats.deadlineExpired || stats.timedOut) ? CTBotRequestTimeout : CTBotRequestNoConnection;
+		else if (batch.m_discardResponses) {
+			batch.m_status[i] = checkResponsePrefix(responses[i], &batch.m_errorCode[i]);
+			if (429 == batch.m_errorCode[i])
+				batch.m_retryAfter[i] = parseRetryAfter(responses[i]);
+		}
+		else {
+#if ARDUINOJSON_VERSION_MAJOR == 5
+			DynamicJsonBuffer jsonBuffer;
+			JsonObject& root = jsonBuffer.parse(responses[i]);
+#elif ARDUINOJSON_VERSION_MAJOR == 6
+			DynamicJsonDocument root(CTBOT_JSON6_BUFFER_SIZE);
+			DeserializationError error = deserializeJson(root, responses[i]);
+			if (error) {
+				serialLog(FSTR("sendBatch error: ArduinoJson deserialization error code: "), CTBOT_DEBUG_JSON);
+				serialLog(error.c_str(), CTBOT_DEBUG_JSON);
+				serialLog("\n", CTBOT_DEBUG_JSON);
+				batch.m_status[i] = CTBotRequestParseError;
+			}
+			else
+#endif
+			if (!root[FSTR("ok")]) {
+				batch.m_errorCode[i]  = root[FSTR("error_code")].as<int>();
+				batch.m_retryAfter[i] = root[FSTR("parameters")][FSTR("retry_after")].as<uint16_t>();
+				m_metrics.addAPIError(batch.m_errorCode[i]);
+				batch.m_status[i] = CTBotRequestAPIError;
+			}
+			else
+				batch.m_messageID[i] = root[FSTR("result")][FSTR("message_id")].as<int32_t>();
+		}
+
+		if (batch.m_status[i] != CTBotRequestOK) {
+			setRequestError(batch.m_status[i]);
+			success = false;
+		}
+	}
+	return(success);
+}
+
+bool CTBot::queueMessage(int64_t id, const String& message, CTBotPriority priority, const String& keyboard)
+{
+	if (0 == message.length())
+		return false;
+	return(m_outbox.add(CTBotApiSendMessage, priority, id, 0, sendMessageParameters(id, message, keyboard)));
+}
+
+bool CTBot::queueEditMessageText(int64_t id, int32_t messageID, const String& message, CTBotPriority priority, const String& keyboard)
+{
+	if (0 == message.length())
+		return false;
+	return(m_outbox.add(CTBotApiEditMessageText, priority, id, messageID, editMessageTextParameters(id, messageID, message, keyboard)));
+}
+
+uint8_t CTBot::processOutbox(void)
+{
+	if (0 == m_outbox.getCount())
+		return 0;
+	if ((millis() - m_outboxTimeStamp) < m_outboxInterval)
+		return 0;
+	m_outboxTimeStamp = millis();
+	m_outboxInterval  = CTBOT_OUTBOX_INTERVAL;
+
+	// the selected calls are pipelined on the same connection
+	uint8_t slots[CTBOT_MAX_BATCH_SIZE];
+	uint8_t count = m_outbox.select(slots, CTBOT_MAX_BATCH_SIZE);
+	// the queued calls don't return the message ID: no need to parse the responses
+	CTBotBatch batch;
+	batch.setDiscardResponses(true);
+	for (uint8_t i = 0; i < count; i++)
+		batch.add(m_outbox.getMethod(slots[i]), m_outbox.getParameters(slots[i]));
+	sendBatch(batch);
+
+	uint8_t sent = 0;
+	for (uint8_t i = 0; i < count; i++) {
+		CTBotRequestStatus status = batch.getStatus(i);
+		int errorCode = batch.m_errorCode[i];
+		if (429 == errorCode) {
+			// flood limit: the whole queue waits as long as the Telegram server asks
+			uint32_t retryAfter = (0 == batch.m_retryAfter[i]) ? CTBOT_OUTBOX_INTERVAL : (uint32_t)batch.m_retryAfter[i] * 1000;
+			if (retryAfter > m_outboxInterval)
+				m_outboxInterval = retryAfter;
+		}
+		// transient failures (no connection, timeout, flood limit, server errors, unexpected response)
+		// stay queued. Only a sent call or a permanent error (bad request, forbidden...) is removed
+		bool permanent = (CTBotRequestAPIError == status) && (errorCode >= 400) && (errorCode < 500) && (errorCode != 429);
+		if ((status != CTBotRequestOK) && !permanent)
+			continue;
+		m_outbox.remove(slots[i]);
+		if (CTBotRequestOK == status)
+			sent++;
+	}
+	return(sent);
+}
+
+uint8_t CTBot::getOutboxCount(void)
+{
+	return(m_outbox.getCount());
+}
+
+void CTBot::syncServerTime(const CTBotRequestStats& stats)
+{
+	if (stats.serverTime != 0) {
+		// synchronize the clock: the "Date" header is generated when the response starts
+		m_serverTime      = stats.serverTime;
+		m_serverTimeStamp = millis() - stats.transferTime;
+	}
+}
+
+void CTBot::setRequestError(CTBotRequestStatus status)
+{
+	if (CTBotRequestOK == m_lastStatus)
+		m_lastStatus = status;
+}
+
+void CTBot::setAPIError(int errorCode)
+{
+	m_metrics.addAPIError(errorCode);
+	if (401 == errorCode)
+		m_state.clearIdentity(); // unauthorized: the token was revoked
+	setRequestError(CTBotRequestAPIError);
+}
+
+int32_t CTBot::parseMessageID(const String& response)
+{
+	if (0 == response.length())
+		return 0;
+
+#if ARDUINOJSON_VERSION_MAJOR == 5
+	DynamicJsonBuffer jsonBuffer;
+	JsonObject& root = jsonBuffer.parse(response);
+#elif ARDUINOJSON_VERSION_MAJOR == 6
+	DynamicJsonDocument root(CTBOT_JSON6_BUFFER_SIZE);
+	DeserializationError error = deserializeJson(root, response);
+	if (error) {
+		serialLog(FSTR("parseMessageID error: ArduinoJson deserialization error code: "), CTBOT_DEBUG_JSON);
+		serialLog(error.c_str(), CTBOT_DEBUG_JSON);
+		serialLog("\n", CTBOT_DEBUG_JSON);
+		setRequestError(CTBotRequestParseError);
+		return 0;
+	}
+#endif
+
+	if (!root[FSTR("ok")]) {
+		setAPIError(root[FSTR("error_code")].as<int>());
+		return 0;
+	}
+	return root[FSTR("result")][FSTR("message_id")].as<int32_t>();
+}
+
+CTBotRequestStatus CTBot::checkResponsePrefix(const String& response, int* errorCode)
+{
+	const String errorPrefix = FSTR("{\"ok\":false,\"error_code\":");
+
+	if (errorCode != NULL)
+		*errorCode = 0;
+	if (response.startsWith(FSTR("{\"ok\":true")))
+		return CTBotRequestOK;
+	if (response.startsWith(errorPrefix)) {
+		int code = response.substring(errorPrefix.length()).toInt();
+		m_metrics.addAPIError(code);
+		if (errorCode != NULL)
+			*errorCode = code;
+		return CTBotRequestAPIError;
+	}
+	serialLog(FSTR("checkResponsePrefix error: unexpected response\n"), CTBOT_DEBUG_JSON);
+	return CTBotRequestParseError;
+}
+
+uint16_t CTBot::parseRetryAfter(const String& response)
+{
+	// {"ok":false,"error_code":429,"description":"Too Many Requests: retry after 35","parameters":{"retry_after":35}}
+	// the description comes first, so it is available in the discarded responses prefix too
+	const String retryPrefix = FSTR("retry after ");
+	int index = response.indexOf(retryPrefix);
+	if (index < 0)
+		return 0;
+	return((uint16_t)response.substring(index + retryPrefix.length()).toInt());
+}
+
+CTBotRequestStatus CTBot::getLastStatus(void)
+{
+	return(m_lastStatus);
+}
+
+uint32_t CTBot::getServerTime(void)
+{
+	if (0 == m_serverTime)
+		return 0;
+	return(m_serverTime + (millis() - m_serverTimeStamp) / 1000);
+}
+
+void CTBot::trackDeliveryLag(int32_t date)
+{
+	if ((0 == m_serverTime) || (date <= 0))
+		return;
+
+	// server time in milliseconds (the "Date" header has a one second resolution)
+	uint64_t now = (uint64_t)m_serverTime * 1000 + (millis() - m_serverTimeStamp);
+	uint64_t sent = (uint64_t)date * 1000;
+	m_metrics.addDeliveryLag(now > sent ? (uint32_t)(now - sent) : 0);
 }
 
 String CTBot::toUTF8(String message)
@@ -100,12 +371,29 @@ void CTBot::setStatusPin(int8_t pin)
 void CTBot::setTelegramToken(const String& token)
 {	m_token = token;}
 
+bool CTBot::setPersistence(fs::FS& fs, const String& fileName)
+{
+	bool loaded = m_state.begin(fs, fileName, m_token);
+	if (loaded)
+		m_lastUpdate = m_state.getOffset();
+	// don't wait the poll interval: the first getNewMessage polls immediately
+	m_poller.pollNow();
+	return(loaded);
+}
+
+bool CTBot::savePersistentState(void)
+{
+	return(m_state.save());
+}
+
 bool CTBot::testConnection(void){
 	TBUser user;
 	return(getMe(user));
 }
 
 bool CTBot::getMe(TBUser &user) {
+	// always a round trip: the persisted identity can't prove that the server is reachable
+	CTBotHeapScope heapScope(m_metrics, CTBotApiGetMe);
 
 #if ARDUINOJSON_VERSION_MAJOR == 5
 #if CTBOT_BUFFER_SIZE > 0
@@ -121,11 +409,13 @@ bool CTBot::getMe(TBUser &user) {
 		serialLog(FSTR("getNewMessage error: ArduinoJson deserialization error code: "), CTBOT_DEBUG_JSON);
 		serialLog(error.c_str(), CTBOT_DEBUG_JSON);
 		serialLog("\n", CTBOT_DEBUG_JSON);
+		setRequestError(CTBotRequestParseError);
 		return CTBotMessageNoData;
 	}
 #endif
 
 	if (!root[FSTR("ok")]) {
+		setAPIError(root[FSTR("error_code")].as<int>());
 #if (CTBOT_DEBUG_MODE & CTBOT_DEBUG_JSON) > 0
 		serialLog(FSTR("getMe error:\n"), CTBOT_DEBUG_JSON);
 #if ARDUINOJSON_VERSION_MAJOR == 5
@@ -152,27 +442,38 @@ bool CTBot::getMe(TBUser &user) {
 	user.lastName     = root[FSTR("result")][FSTR("last_name")].as<String>();
 	user.username     = root[FSTR("result")][FSTR("username")].as<String>();
 	user.languageCode = root[FSTR("result")][FSTR("language_code")].as<String>();
+	m_state.setIdentity(user);
 	return true;
 }
 
-CTBotMessageType CTBot::getNewMessage(TBMessage& message, bool blocking) {
+CTBotMessageType CTBot::getNewMessage(TBMessage& message, bool blocking, uint32_t timeout) {
+	// the poll loop drives the WiFi connection manager: no requests while disconnected
+	if (m_wifi.hasNetworks() && (m_wifi.handleConnection() != CTBotWifiConnected))
+		return CTBotMessageNoData;
 
-	if (!blocking) {
-		// check if is passed CTBOT_GET_UPDATE_TIMEOUT ms from the last update
-		uint32_t currentTime = millis();
-		if (m_lastUpdateTimeStamp > currentTime) {
-			// millis has done an overflow and start over
-			if (((UINT32_MAX - m_lastUpdateTimeStamp) + currentTime) < CTBOT_GET_UPDATE_TIMEOUT)
-				return CTBotMessageNoData;
-		}
-		else {
-			if ((currentTime - m_lastUpdateTimeStamp) < CTBOT_GET_UPDATE_TIMEOUT)
-				return CTBotMessageNoData;
-		}
+	// webhook mode: the updates are pushed by the Telegram server, no polling
+	if (m_webhook.isRunning()) {
+		m_webhook.handleClient();
+		processOutbox();
+		m_state.update();
+		return(getWebhookMessage(message));
 	}
 
+	// low power polling: the radio sleeps until the next poll, the outbound queue waits for the same wake window
+	if (m_lowPower.isEnabled() && !blocking && !m_poller.isDue())
+		return CTBotMessageNoData;
+	CTBotWakeScope wakeScope(m_lowPower);
+
+	// the poll loop sends the outbound queue and writes the unsaved state
+	processOutbox();
+	m_state.update();
+
+	if (!blocking && !m_poller.isDue())
+		return CTBotMessageNoData;
+
 	String parameters;
 	char buf[21];
+	CTBotHeapScope heapScope(m_metrics, CTBotApiGetUpdates);
 
 	message.messageType = CTBotMessageNoData;
 
@@ -182,6 +483,7 @@ CTBotMessageType CTBot::getNewMessage(TBMessage& message, bool blocking) {
 	parameters = FSTR("?limit=1&allowed_updates=[\"message\",\"callback_query\"]");
 	if (m_lastUpdate != 0)
 		parameters += (String)FSTR("&offset=") + (String)buf;
+	uint32_t pollStart = millis();
 
 #if ARDUINOJSON_VERSION_MAJOR == 5
 #if CTBOT_BUFFER_SIZE > 0
@@ -190,26 +492,31 @@ CTBotMessageType CTBot::getNewMessage(TBMessage& message, bool blocking) {
 	DynamicJsonBuffer jsonBuffer;
 #endif
 	JsonObject& root = jsonBuffer.parse(m_UTF8Encoding ?
-		toUTF8(sendCommand(FSTR("getUpdates"), parameters)) :
-		sendCommand(FSTR("getUpdates"), parameters));
+		toUTF8(sendCommand(FSTR("getUpdates"), parameters, timeout)) :
+		sendCommand(FSTR("getUpdates"), parameters, timeout));
 #elif ARDUINOJSON_VERSION_MAJOR == 6
 	DynamicJsonDocument root(CTBOT_JSON6_BUFFER_SIZE);
-	DeserializationError error = deserializeJson(root, m_UTF8Encoding ?
-		toUTF8(sendCommand(FSTR("getUpdates"), parameters)) :
-		sendCommand(FSTR("getUpdates"), parameters));
+	String response = m_UTF8Encoding ?
+		toUTF8(sendCommand(FSTR("getUpdates"), parameters, timeout)) :
+		sendCommand(FSTR("getUpdates"), parameters, timeout);
+	traceEvent(CTBotTraceParseStart);
+	DeserializationError error = deserializeJson(root, response);
+	traceEvent(CTBotTraceParseEnd, !error);
 
 	if (error) {
 		serialLog(FSTR("getNewMessage error: ArduinoJson deserialization error code: "), CTBOT_DEBUG_JSON);
 		serialLog(error.c_str(), CTBOT_DEBUG_JSON);
 		serialLog("\n", CTBOT_DEBUG_JSON);
-		m_lastUpdateTimeStamp = millis();
+		setRequestError(CTBotRequestParseError);
+		m_poller.addPoll(false, pollStart);
 		return CTBotMessageNoData;
 	}
 #endif
 
-	m_lastUpdateTimeStamp = millis();
+	m_poller.addPoll(root[FSTR("ok")] && (root[FSTR("result")][0][FSTR("update_id")].as<int32_t>() != 0), pollStart);
 
 	if (!root[FSTR("ok")]) {
+		setAPIError(root[FSTR("error_code")].as<int>());
 #if (CTBOT_DEBUG_MODE & CTBOT_DEBUG_JSON) > 0
 		serialLog(FSTR("getNewMessage error: "), CTBOT_DEBUG_JSON);
 #if ARDUINOJSON_VERSION_MAJOR == 5
@@ -232,83 +539,129 @@ CTBotMessageType CTBot::getNewMessage(TBMessage& message, bool blocking) {
 	serialLog("\n", CTBOT_DEBUG_JSON);
 #endif
 
-	uint32_t updateID = root[FSTR("result")][0][FSTR("update_id")].as<int32_t>();
+	return(parseUpdate(root[FSTR("result")][0], message));
+}
+
+CTBotMessageType CTBot::getWebhookMessage(TBMessage& message) {
+	CTBotHeapScope heapScope(m_metrics, CTBotApiGetUpdates);
+	String update;
+
+	message.messageType = CTBotMessageNoData;
+	while (m_webhook.pop(update)) {
+		if (m_UTF8Encoding)
+			update = toUTF8(update);
+
+#if ARDUINOJSON_VERSION_MAJOR == 5
+#if CTBOT_BUFFER_SIZE > 0
+		StaticJsonBuffer<CTBOT_JSON5_BUFFER_SIZE> jsonBuffer;
+#else
+		DynamicJsonBuffer jsonBuffer;
+#endif
+		JsonObject& root = jsonBuffer.parse(update);
+#elif ARDUINOJSON_VERSION_MAJOR == 6
+		DynamicJsonDocument root(CTBOT_JSON6_BUFFER_SIZE);
+		traceEvent(CTBotTraceParseStart);
+		DeserializationError error = deserializeJson(root, update);
+		traceEvent(CTBotTraceParseEnd, !error);
+		if (error) {
+			serialLog(FSTR("getWebhookMessage error: ArduinoJson deserialization error code: "), CTBOT_DEBUG_JSON);
+			serialLog(error.c_str(), CTBOT_DEBUG_JSON);
+			serialLog("\n", CTBOT_DEBUG_JSON);
+			continue;
+		}
+#endif
+
+		// the Telegram server sends an update again if it missed the answer
+		if ((m_lastUpdate != 0) && (root[FSTR("update_id")].as<int32_t>() + 1 == m_lastUpdate))
+			continue;
+
+		CTBotMessageType type = parseUpdate(root, message);
+		if (type != CTBotMessageNoData)
+			return(type);
+	}
+	return CTBotMessageNoData;
+}
+
+CTBotMessageType CTBot::parseUpdate(JsonVariant update, TBMessage& message) {
+	uint32_t updateID = update[FSTR("update_id")].as<int32_t>();
 	if (0 == updateID)
 		return CTBotMessageNoData;
 	m_lastUpdate = updateID + 1;
+	m_state.setOffset(m_lastUpdate);
+	m_metrics.addUpdate();
+	m_lowPower.addUpdate();
 
-	if (root[FSTR("result")][0][FSTR("callback_query")][FSTR("id")]) {
+	if (update[FSTR("callback_query")][FSTR("id")]) {
 		// this is a callback query
-		message.messageID         = root[FSTR("result")][0][FSTR("callback_query")][FSTR("message")][FSTR("message_id")].as<int32_t>();
-		message.text              = root[FSTR("result")][0][FSTR("callback_query")][FSTR("message")][FSTR("text")].as<String>();
-		message.date              = root[FSTR("result")][0][FSTR("callback_query")][FSTR("message")][FSTR("date")].as<int32_t>();
-		message.sender.id         = root[FSTR("result")][0][FSTR("callback_query")][FSTR("from")][FSTR("id")].as<int64_t>();
-		message.sender.username   = root[FSTR("result")][0][FSTR("callback_query")][FSTR("from")][FSTR("username")].as<String>();
-		message.sender.firstName  = root[FSTR("result")][0][FSTR("callback_query")][FSTR("from")][FSTR("first_name")].as<String>();
-		message.sender.lastName   = root[FSTR("result")][0][FSTR("callback_query")][FSTR("from")][FSTR("last_name")].as<String>();
-		message.callbackQueryID   = root[FSTR("result")][0][FSTR("callback_query")][FSTR("id")].as<String>();
-		message.callbackQueryData = root[FSTR("result")][0][FSTR("callback_query")][FSTR("data")].as<String>();
-		message.chatInstance      = root[FSTR("result")][0][FSTR("callback_query")][FSTR("chat_instance")].as<String>();
+		message.messageID         = update[FSTR("callback_query")][FSTR("message")][FSTR("message_id")].as<int32_t>();
+		message.text              = update[FSTR("callback_query")][FSTR("message")][FSTR("text")].as<String>();
+		message.date              = update[FSTR("callback_query")][FSTR("message")][FSTR("date")].as<int32_t>();
+		message.sender.id         = update[FSTR("callback_query")][FSTR("from")][FSTR("id")].as<int64_t>();
+		message.sender.username   = update[FSTR("callback_query")][FSTR("from")][FSTR("username")].as<String>();
+		message.sender.firstName  = update[FSTR("callback_query")][FSTR("from")][FSTR("first_name")].as<String>();
+		message.sender.lastName   = update[FSTR("callback_query")][FSTR("from")][FSTR("last_name")].as<String>();
+		message.callbackQueryID   = update[FSTR("callback_query")][FSTR("id")].as<String>();
+		message.callbackQueryData = update[FSTR("callback_query")][FSTR("data")].as<String>();
+		message.chatInstance      = update[FSTR("callback_query")][FSTR("chat_instance")].as<String>();
 		message.messageType       = CTBotMessageQuery;
-		message.group.id          = root[FSTR("result")][0][FSTR("callback_query")][FSTR("message")][FSTR("chat")][FSTR("id")].as<int64_t>();
-		message.group.title       = root[FSTR("result")][0][FSTR("callback_query")][FSTR("message")][FSTR("chat")][FSTR("title")].as<String>();
-		
-		serialLog(FSTR("--->getNewMessage: Free heap memory : "), CTBOT_DEBUG_MEMORY);
-		serialLog(ESP.getFreeHeap(), CTBOT_DEBUG_MEMORY);
-		serialLog("\n", CTBOT_DEBUG_MEMORY);
+		message.group.id          = update[FSTR("callback_query")][FSTR("message")][FSTR("chat")][FSTR("id")].as<int64_t>();
+		message.group.title       = update[FSTR("callback_query")][FSTR("message")][FSTR("chat")][FSTR("title")].as<String>();
 
 		return CTBotMessageQuery;
 	}
-	else if (root[FSTR("result")][0][FSTR("message")][FSTR("message_id")]) {
+	else if (update[FSTR("message")][FSTR("message_id")]) {
 		// this is a message
-		message.messageID        = root[FSTR("result")][0][FSTR("message")][FSTR("message_id")].as<int32_t>();
-		message.sender.id        = root[FSTR("result")][0][FSTR("message")][FSTR("from")][FSTR("id")].as<int64_t>();
-		message.sender.username  = root[FSTR("result")][0][FSTR("message")][FSTR("from")][FSTR("username")].as<String>();
-		message.sender.firstName = root[FSTR("result")][0][FSTR("message")][FSTR("from")][FSTR("first_name")].as<String>();
-		message.sender.lastName  = root[FSTR("result")][0][FSTR("message")][FSTR("from")][FSTR("last_name")].as<String>();
-		message.group.id         = root[FSTR("result")][0][FSTR("message")][FSTR("chat")][FSTR("id")].as<int64_t>();
-		message.group.title      = root[FSTR("result")][0][FSTR("message")][FSTR("chat")][FSTR("title")].as<String>();
-		message.date             = root[FSTR("result")][0][FSTR("message")][FSTR("date")].as<int32_t>();
+		message.messageID        = update[FSTR("message")][FSTR("message_id")].as<int32_t>();
+		message.sender.id        = update[FSTR("message")][FSTR("from")][FSTR("id")].as<int64_t>();
+		message.sender.username  = update[FSTR("message")][FSTR("from")][FSTR("username")].as<String>();
+		message.sender.firstName = update[FSTR("message")][FSTR("from")][FSTR("first_name")].as<String>();
+		message.sender.lastName  = update[FSTR("message")][FSTR("from")][FSTR("last_name")].as<String>();
+		message.group.id         = update[FSTR("message")][FSTR("chat")][FSTR("id")].as<int64_t>();
+		message.group.title      = update[FSTR("message")][FSTR("chat")][FSTR("title")].as<String>();
+		message.date             = update[FSTR("message")][FSTR("date")].as<int32_t>();
 
 #if ARDUINOJSON_VERSION_MAJOR == 5
-		if (root[FSTR("result")][0][FSTR("message")][FSTR("text")].as<String>().length() != 0) {
+		if (update[FSTR("message")][FSTR("text")].as<String>().length() != 0) {
 #elif ARDUINOJSON_VERSION_MAJOR == 6
-		if (root[FSTR("result")][0][FSTR("message")][FSTR("text")]) {
+		if (update[FSTR("message")][FSTR("text")]) {
 #endif
 			// this is a text message
-			message.text = root[FSTR("result")][0][FSTR("message")][FSTR("text")].as<String>();
+			message.text = update[FSTR("message")][FSTR("text")].as<String>();
 			message.messageType = CTBotMessageText;
-
-			serialLog(FSTR("--->getNewMessage: Free heap memory : "), CTBOT_DEBUG_MEMORY);
-			serialLog(ESP.getFreeHeap(), CTBOT_DEBUG_MEMORY);
-			serialLog("\n", CTBOT_DEBUG_MEMORY);
+			trackDeliveryLag(message.date);
 
 			return CTBotMessageText;
 		}
-		else if (root[FSTR("result")][0][FSTR("message")][FSTR("location")]) {
+		else if (update[FSTR("message")][FSTR("location")]) {
 			// this is a location message
-			message.location.longitude = root[FSTR("result")][0][FSTR("message")][FSTR("location")][FSTR("longitude")].as<float>();
-			message.location.latitude  = root[FSTR("result")][0][FSTR("message")][FSTR("location")][FSTR("latitude")].as<float>();
+			message.location.longitude = update[FSTR("message")][FSTR("location")][FSTR("longitude")].as<float>();
+			message.location.latitude  = update[FSTR("message")][FSTR("location")][FSTR("latitude")].as<float>();
 			message.messageType = CTBotMessageLocation;
-
-			serialLog(FSTR("--->getNewMessage: Free heap memory : "), CTBOT_DEBUG_MEMORY);
-			serialLog(ESP.getFreeHeap(), CTBOT_DEBUG_MEMORY);
-			serialLog("\n", CTBOT_DEBUG_MEMORY);
+			trackDeliveryLag(message.date);
 
 			return CTBotMessageLocation;
 		}
-		else if (root[FSTR("result")][0][FSTR("message")][FSTR("contact")]) {
+		else if (update[FSTR("message")][FSTR("document")]) {
+			// this is a document message, the caption (if any) goes in the text
+			message.document.fileID   = update[FSTR("message")][FSTR("document")][FSTR("file_id")].as<String>();
+			message.document.fileName = update[FSTR("message")][FSTR("document")][FSTR("file_name")].as<String>();
+			message.document.mimeType = update[FSTR("message")][FSTR("document")][FSTR("mime_type")].as<String>();
+			message.document.fileSize = update[FSTR("message")][FSTR("document")][FSTR("file_size")].as<int32_t>();
+			message.text              = update[FSTR("message")][FSTR("caption")].as<String>();
+			message.messageType = CTBotMessageDocument;
+			trackDeliveryLag(message.date);
+
+			return CTBotMessageDocument;
+		}
+		else if (update[FSTR("message")][FSTR("contact")]) {
 			// this is a contact message
-			message.contact.id          = root[FSTR("result")][0][FSTR("message")][FSTR("contact")][FSTR("user_id")].as<int64_t>();
-			message.contact.firstName   = root[FSTR("result")][0][FSTR("message")][FSTR("contact")][FSTR("first_name")].as<String>();
-			message.contact.lastName    = root[FSTR("result")][0][FSTR("message")][FSTR("contact")][FSTR("last_name")].as<String>();
-			message.contact.phoneNumber = root[FSTR("result")][0][FSTR("message")][FSTR("contact")][FSTR("phone_number")].as<String>();
-			message.contact.vCard       = root[FSTR("result")][0][FSTR("message")][FSTR("contact")][FSTR("vcard")].as<String>();
+			message.contact.id          = update[FSTR("message")][FSTR("contact")][FSTR("user_id")].as<int64_t>();
+			message.contact.firstName   = update[FSTR("message")][FSTR("contact")][FSTR("first_name")].as<String>();
+			message.contact.lastName    = update[FSTR("message")][FSTR("contact")][FSTR("last_name")].as<String>();
+			message.contact.phoneNumber = update[FSTR("message")][FSTR("contact")][FSTR("phone_number")].as<String>();
+			message.contact.vCard       = update[FSTR("message")][FSTR("contact")][FSTR("vcard")].as<String>();
 			message.messageType = CTBotMessageContact;
-
-			serialLog(FSTR("--->getNewMessage: Free heap memory : "), CTBOT_DEBUG_MEMORY);
-			serialLog(ESP.getFreeHeap(), CTBOT_DEBUG_MEMORY);
-			serialLog("\n", CTBOT_DEBUG_MEMORY);
+			trackDeliveryLag(message.date);
 
 			return CTBotMessageContact;
 		}
@@ -317,20 +670,20 @@ CTBotMessageType CTBot::getNewMessage(TBMessage& message, bool blocking) {
 	return CTBotMessageNoData;
 }
 
-int32_t CTBot::sendMessage(int64_t id, const String& message, const String& keyboard)
+int32_t CTBot::sendMessage(int64_t id, const String& message, const String& keyboard, uint32_t timeout)
 {
-	String parameters;
-	String strID;
+	CTBotHeapScope heapScope(m_metrics, CTBotApiSendMessage);
 
 	if (0 == message.length())
 		return 0;
 
-	strID = int64ToAscii(id);
-
-	parameters = (String)FSTR("?chat_id=") + strID + (String)FSTR("&text=") + URLEncodeMessage(message);
+	if (getMessageChunkEnd(message, 0, CTBOT_MAX_MESSAGE_LENGTH, CTBOT_MAX_MESSAGE_URL_SIZE) < message.length()) {
+		int32_t messageID = 0;
+		uint16_t count = sendLongMessage(id, message, &messageID, 1, keyboard, timeout);
+		return((count != 0) && (CTBotRequestOK == m_lastStatus) ? messageID : 0);
+	}
 
-	if (keyboard.length() != 0)
-		parameters += (String)FSTR("&reply_markup=") + keyboard;
+	String parameters = sendMessageParameters(id, message, keyboard);
 
 #if ARDUINOJSON_VERSION_MAJOR == 5
 #if CTBOT_BUFFER_SIZE > 0
@@ -338,19 +691,24 @@ int32_t CTBot::sendMessage(int64_t id, const String& message, const String& keyb
 #else
 	DynamicJsonBuffer jsonBuffer;
 #endif
-	JsonObject& root = jsonBuffer.parse(sendCommand(FSTR("sendMessage"), parameters));
+	JsonObject& root = jsonBuffer.parse(sendCommand(FSTR("sendMessage"), parameters, timeout));
 #elif ARDUINOJSON_VERSION_MAJOR == 6
 	DynamicJsonDocument root(CTBOT_JSON6_BUFFER_SIZE);
-	DeserializationError error = deserializeJson(root, sendCommand(FSTR("sendMessage"), parameters));
+	String response = sendCommand(FSTR("sendMessage"), parameters, timeout);
+	traceEvent(CTBotTraceParseStart);
+	DeserializationError error = deserializeJson(root, response);
+	traceEvent(CTBotTraceParseEnd, !error);
 	if (error) {
 		serialLog(FSTR("getNewMessage error: ArduinoJson deserialization error code: "), CTBOT_DEBUG_JSON);
 		serialLog(error.c_str(), CTBOT_DEBUG_JSON);
 		serialLog("\n", CTBOT_DEBUG_JSON);
+		setRequestError(CTBotRequestParseError);
 		return 0;
 	}
 #endif
 
 	if (!root[FSTR("ok")]) {
+		setAPIError(root[FSTR("error_code")].as<int>());
 #if (CTBOT_DEBUG_MODE & CTBOT_DEBUG_JSON) > 0
 		serialLog(FSTR("SendMessage error: "), CTBOT_DEBUG_JSON);
 #if ARDUINOJSON_VERSION_MAJOR == 5
@@ -377,28 +735,290 @@ int32_t CTBot::sendMessage(int64_t id, const String& message, const String& keyb
 	;
 }
 
-int32_t CTBot::sendMessage(int64_t id, const String& message, CTBotInlineKeyboard &keyboard) {
-	return(sendMessage(id, message, keyboard.getJSON()));
+int32_t CTBot::sendMessage(int64_t id, const String& message, CTBotInlineKeyboard &keyboard, uint32_t timeout) {
+	return(sendMessage(id, message, keyboard.getJSON(), timeout));
 }
 
-int32_t CTBot::sendMessage(int64_t id, const String& message, CTBotReplyKeyboard &keyboard) {
-	return(sendMessage(id, message, keyboard.getJSON()));
+int32_t CTBot::sendMessage(int64_t id, const String& message, CTBotReplyKeyboard &keyboard, uint32_t timeout) {
+	return(sendMessage(id, message, keyboard.getJSON(), timeout));
 }
 
-bool CTBot::editMessageText(int64_t id, int32_t messageID, const String& message, const String& keyboard)
+bool CTBot::sendNotification(int64_t id, const String& message, const String& keyboard, uint32_t timeout)
 {
-	String parameters;
-	String strID;
+	CTBotHeapScope heapScope(m_metrics, CTBotApiSendMessage);
 
 	if (0 == message.length())
 		return false;
 
-	strID = int64ToAscii(id);
+	String response = sendCommand(FSTR("sendMessage"), sendMessageParameters(id, message, keyboard), timeout, true);
+	if (0 == response.length())
+		return false;
+
+	CTBotRequestStatus status = checkResponsePrefix(response);
+	if (status != CTBotRequestOK) {
+		setRequestError(status);
+		return false;
+	}
+	return true;
+}
+
+bool CTBot::sendNotification(int64_t id, const String& message, CTBotInlineKeyboard &keyboard, uint32_t timeout) {
+	return(sendNotification(id, message, keyboard.getJSON(), timeout));
+}
 
-	parameters = (String)FSTR("?chat_id=") + strID + (String)FSTR("&message_id=") + (String)messageID + (String)FSTR("&text=") + URLEncodeMessage(message);
+bool CTBot::sendNotification(int64_t id, const String& message, CTBotReplyKeyboard &keyboard, uint32_t timeout) {
+	return(sendNotification(id, message, keyboard.getJSON(), timeout));
+}
+
+uint16_t CTBot::sendLongMessage(int64_t id, const String& message, int32_t* messageIDs, uint16_t maxIDs,
+	const String& keyboard, uint32_t timeout)
+{
+	CTBotBatch batch;
+	uint32_t start = 0;
+	uint16_t sent = 0;
+
+	m_lastStatus = CTBotRequestOK;
+	while (start < message.length()) {
+		// only the chunk offsets: every chunk is URL encoded straight from the source text
+		batch.clear();
+		while ((start < message.length()) && (batch.getCount() < CTBOT_MAX_BATCH_SIZE)) {
+			uint32_t end = getMessageChunkEnd(message, start, CTBOT_MAX_MESSAGE_LENGTH, CTBOT_MAX_MESSAGE_URL_SIZE);
+			batch.add(CTBotApiSendMessage, sendMessageParameters(id, message, start, end,
+				(end < message.length()) ? (String)"" : keyboard));
+			start = end;
+		}
+
+		sendBatch(batch, timeout);
+		for (uint8_t i = 0; i < batch.getCount(); i++) {
+			if (batch.getStatus(i) != CTBotRequestOK)
+				return(sent);
+			if ((messageIDs != NULL) && (sent < maxIDs))
+				messageIDs[sent] = batch.getMessageID(i);
+			sent++;
+		}
+	}
+	return(sent);
+}
+
+int32_t CTBot::sendFile(const String& command, const String& field, int64_t id, Stream& data, uint32_t size,
+	const String& fileName, const String& caption, uint32_t timeout)
+{
+	CTBotHeapScope heapScope(m_metrics, CTBotApiOther);
+	CTBotWakeScope wakeScope(m_lowPower);
+
+	// the parameters go in the query string, the form contains only the file
+	String path = (String)FSTR("/bot") + m_token + (String)"/" + command + (String)FSTR("?chat_id=") + int64ToAscii(id);
+	if (caption.length() != 0)
+		path += (String)FSTR("&caption=") + URLEncodeMessage(caption);
+
+	traceEvent(CTBotTraceRequestStart, CTBotApiOther);
+	uint32_t startTime = millis();
+	String response = m_connection.upload(path, field, fileName, data, size, timeout);
+	endRequest(CTBotApiOther, startTime, response.length() != 0);
+
+	return(parseMessageID(response));
+}
+
+// the file name, without the directories
+static String getFileName(fs::File& file)
+{
+	String name = file.name();
+	return(name.substring(name.lastIndexOf('/') + 1));
+}
+
+int32_t CTBot::sendPhoto(int64_t id, Stream& photo, uint32_t size, const String& fileName, const String& caption, uint32_t timeout)
+{
+	return(sendFile(FSTR("sendPhoto"), FSTR("photo"), id, photo, size, fileName, caption, timeout));
+}
 
+int32_t CTBot::sendPhoto(int64_t id, fs::File& photo, const String& caption, uint32_t timeout)
+{
+	return(sendPhoto(id, photo, photo.size(), getFileName(photo), caption, timeout));
+}
+
+int32_t CTBot::sendDocument(int64_t id, Stream& document, uint32_t size, const String& fileName, const String& caption, uint32_t timeout)
+{
+	return(sendFile(FSTR("sendDocument"), FSTR("document"), id, document, size, fileName, caption, timeout));
+}
+
+int32_t CTBot::sendDocument(int64_t id, fs::File& document, const String& caption, uint32_t timeout)
+{
+	return(sendDocument(id, document, document.size(), getFileName(document), caption, timeout));
+}
+
+uint16_t CTBot::broadcastMessage(const int64_t* ids, uint16_t count, const String& message, CTBotRequestStatus* results,
+	const String& keyboard, uint32_t timeout)
+{
+	CTBotHeapScope heapScope(m_metrics, CTBotApiSendMessage);
+	CTBotWakeScope wakeScope(m_lowPower); // a single wake window for the whole fan-out
+
+	String paths[CTBOT_BROADCAST_BATCH_SIZE];
+	String responses[CTBOT_BROADCAST_BATCH_SIZE];
+
+	memset(&m_broadcastStats, 0, sizeof(m_broadcastStats));
+	m_broadcastStats.recipients = count;
+	uint32_t startTime = millis();
+
+	if (0 == message.length()) {
+		for (uint16_t i = 0; (results != NULL) && (i < count); i++)
+			results[i] = CTBotRequestParseError;
+		return 0;
+	}
+
+	// the text is URL encoded once and appended to every request while writing it
+	String suffix = (String)FSTR("&text=") + URLEncodeMessage(message);
 	if (keyboard.length() != 0)
-		parameters += (String)FSTR("&reply_markup=") + keyboard;
+		suffix += (String)FSTR("&reply_markup=") + keyboard;
+
+	m_lastStatus = CTBotRequestOK;
+	uint32_t due = startTime; // when the next batch can be sent
+	uint16_t sent = 0;
+	while (sent < count) {
+		// flood limits: no more than CTBOT_BROADCAST_RATE messages per second
+		int32_t wait = (int32_t)(due - millis());
+		if (wait > 0) {
+			delay(wait);
+			m_broadcastStats.throttled += wait;
+		}
+
+		uint8_t batchSize = 0;
+		while ((batchSize < CTBOT_BROADCAST_BATCH_SIZE) && (sent + batchSize < count)) {
+			paths[batchSize] = (String)FSTR("/bot") + m_token + (String)FSTR("/sendMessage?chat_id=") + int64ToAscii(ids[sent + batchSize]);
+			batchSize++;
+		}
+
+		due += (uint32_t)batchSize * 1000 / CTBOT_BROADCAST_RATE;
+
+		traceEvent(CTBotTraceRequestStart, CTBotApiSendMessage);
+		uint32_t batchStart = millis();
+		m_connection.sendBatch(paths, responses, batchSize, timeout, true, suffix);
+		uint32_t elapsed = millis() - batchStart;
+		const CTBotRequestStats& stats = m_connection.getLastRequestStats();
+		traceEvent(CTBotTraceRequestEnd, stats.bytesIn);
+		syncServerTime(stats);
+		m_broadcastStats.connections++;
+		m_broadcastStats.bytesOut += stats.bytesOut;
+		m_broadcastStats.bytesIn  += stats.bytesIn;
+
+		CTBotRequestStats itemStats = stats;
+		for (uint8_t i = 0; i < batchSize; i++) {
+			// the connection phases and the bytes are accounted by the first request only
+			if (i > 0)
+				memset(&itemStats, 0, sizeof(itemStats));
+			itemStats.timedOut = stats.timedOut && (0 == responses[i].length());
+			m_metrics.addRequest(CTBotApiSendMessage, elapsed, responses[i].length() != 0, itemStats);
+
+			CTBotRequestStatus status;
+			int errorCode = 0;
+			if (0 == responses[i].length())
+				status = (stats.deadlineExpired || stats.timedOut) ? CTBotRequestTimeout : CTBotRequestNoConnection;
+			else
+				status = checkResponsePrefix(responses[i], &errorCode);
+
+			if (CTBotRequestOK == status)
+				m_broadcastStats.delivered++;
+			else
+				setRequestError(status);
+			if (429 == errorCode) {
+				// slow down: the next batch waits
+				m_broadcastStats.tooManyRequests++;
+				if ((int32_t)(millis() + CTBOT_BROADCAST_BACKOFF - due) > 0)
+					due = millis() + CTBOT_BROADCAST_BACKOFF;
+			}
+			if (results != NULL)
+				results[sent + i] = status;
+		}
+		sent += batchSize;
+	}
+
+	m_broadcastStats.elapsed = millis() - startTime;
+	return(m_broadcastStats.delivered);
+}
+
+bool CTBot::getFile(const String& fileID, TBFile& file, uint32_t timeout)
+{
+	CTBotHeapScope heapScope(m_metrics, CTBotApiOther);
+
+	file.fileID   = fileID;
+	file.filePath = "";
+	file.fileSize = 0;
+
+	String response = sendCommand(FSTR("getFile"), (String)FSTR("?file_id=") + fileID, timeout);
+	if (0 == response.length())
+		return false;
+
+#if ARDUINOJSON_VERSION_MAJOR == 5
+	DynamicJsonBuffer jsonBuffer;
+	JsonObject& root = jsonBuffer.parse(response);
+#elif ARDUINOJSON_VERSION_MAJOR == 6
+	DynamicJsonDocument root(CTBOT_JSON6_BUFFER_SIZE);
+	DeserializationError error = deserializeJson(root, response);
+	if (error) {
+		serialLog(FSTR("getFile error: ArduinoJson deserialization error code: "), CTBOT_DEBUG_JSON);
+		serialLog(error.c_str(), CTBOT_DEBUG_JSON);
+		serialLog("\n", CTBOT_DEBUG_JSON);
+		setRequestError(CTBotRequestParseError);
+		return false;
+	}
+#endif
+
+	if (!root[FSTR("ok")]) {
+		setAPIError(root[FSTR("error_code")].as<int>());
+		return false;
+	}
+	file.filePath = root[FSTR("result")][FSTR("file_path")].as<String>();
+	file.fileSize = root[FSTR("result")][FSTR("file_size")].as<int32_t>();
+	return(file.filePath.length() != 0);
+}
+
+uint32_t CTBot::downloadFile(const TBFile& file, Stream& sink, CTBotProgressCallback progress, uint32_t timeout)
+{
+	CTBotHeapScope heapScope(m_metrics, CTBotApiOther);
+	CTBotWakeScope wakeScope(m_lowPower); // a single wake window for all the attempts
+
+	const String path = (String)FSTR("/file/bot") + m_token + (String)"/" + file.filePath;
+	uint32_t total = (file.fileSize > 0) ? file.fileSize : 0;
+	uint32_t downloaded = 0;
+	uint8_t attempts = 0;
+
+	m_lastStatus = CTBotRequestOK;
+	while (attempts < CTBOT_DOWNLOAD_RETRIES) {
+		uint32_t written;
+		traceEvent(CTBotTraceRequestStart, CTBotApiOther);
+		uint32_t startTime = millis();
+		bool complete = m_connection.download(path, sink, downloaded, total, progress, written, timeout);
+		const CTBotRequestStats& stats = m_connection.getLastRequestStats();
+		endRequest(CTBotApiOther, startTime, complete);
+		downloaded += written;
+
+		if (complete)
+			return(downloaded);
+		if ((stats.statusCode != 0) && (stats.statusCode != 200) && (stats.statusCode != 206)) {
+			// i.e. 404 (expired file path): retrying is useless
+			m_metrics.addAPIError(stats.statusCode);
+			m_lastStatus = CTBotRequestAPIError;
+			return(downloaded);
+		}
+		// retry from where the download stopped. An attempt that made progress doesn't count
+		if (written > 0)
+			attempts = 0;
+		else
+			attempts++;
+		serialLog(FSTR("downloadFile: resuming from byte "), CTBOT_DEBUG_CONNECTION);
+		serialLog(downloaded, CTBOT_DEBUG_CONNECTION);
+		serialLog("\n", CTBOT_DEBUG_CONNECTION);
+	}
+	return(downloaded);
+}
+
+bool CTBot::editMessageText(int64_t id, int32_t messageID, const String& message, const String& keyboard, uint32_t timeout)
+{
+	CTBotHeapScope heapScope(m_metrics, CTBotApiEditMessageText);
+
+	if (0 == message.length())
+		return false;
+
+	String parameters = editMessageTextParameters(id, messageID, message, keyboard);
 
 #if ARDUINOJSON_VERSION_MAJOR == 5
 #if CTBOT_BUFFER_SIZE > 0
@@ -406,19 +1026,21 @@ bool CTBot::editMessageText(int64_t id, int32_t messageID, const String& message
 #else
 	DynamicJsonBuffer jsonBuffer;
 #endif
-	JsonObject& root = jsonBuffer.parse(sendCommand(FSTR("editMessageText"), parameters));
+	JsonObject& root = jsonBuffer.parse(sendCommand(FSTR("editMessageText"), parameters, timeout));
 #elif ARDUINOJSON_VERSION_MAJOR == 6
 	DynamicJsonDocument root(CTBOT_JSON6_BUFFER_SIZE);
-	DeserializationError error = deserializeJson(root, sendCommand(FSTR("editMessageText"), parameters));
+	DeserializationError error = deserializeJson(root, sendCommand(FSTR("editMessageText"), parameters, timeout));
 	if (error) {
 		serialLog(FSTR("getNewMessage error: ArduinoJson deserialization error code: "), CTBOT_DEBUG_JSON);
 		serialLog(error.c_str(), CTBOT_DEBUG_JSON);
 		serialLog("\n", CTBOT_DEBUG_JSON);
+		setRequestError(CTBotRequestParseError);
 		return CTBotMessageNoData;
 	}
 #endif
 
 	if (!root[FSTR("ok")]) {
+		setAPIError(root[FSTR("error_code")].as<int>());
 #if (CTBOT_DEBUG_MODE & CTBOT_DEBUG_JSON) > 0
 		serialLog(FSTR("SendMessage error: "), CTBOT_DEBUG_JSON);
 #if ARDUINOJSON_VERSION_MAJOR == 5
@@ -444,25 +1066,18 @@ bool CTBot::editMessageText(int64_t id, int32_t messageID, const String& message
 	return true;
 }
 
-bool CTBot::editMessageText(int64_t id, int32_t messageID, const String& message, CTBotInlineKeyboard &keyboard) {
-	return(editMessageText(id, messageID, message, keyboard.getJSON()));
+bool CTBot::editMessageText(int64_t id, int32_t messageID, const String& message, CTBotInlineKeyboard &keyboard, uint32_t timeout) {
+	return(editMessageText(id, messageID, message, keyboard.getJSON(), timeout));
 }
 
-bool CTBot::endQuery(const String& queryID, const String& message, bool alertMode)
+bool CTBot::endQuery(const String& queryID, const String& message, bool alertMode, uint32_t timeout)
 {
-	String parameters;
+	CTBotHeapScope heapScope(m_metrics, CTBotApiAnswerCallbackQuery);
 
 	if (0 == queryID.length())
 		return false;
 
-	parameters = (String)FSTR("?callback_query_id=") + queryID;
-
-	if (message.length() != 0) {
-		if (alertMode)
-			parameters += (String)FSTR("&text=") + URLEncodeMessage(message) + (String)FSTR("&show_alert=true");
-		else
-			parameters += (String)FSTR("&text=") + URLEncodeMessage(message) + (String)FSTR("&show_alert=false");
-	}
+	String parameters = answerCallbackQueryParameters(queryID, message, alertMode);
 
 #if ARDUINOJSON_VERSION_MAJOR == 5
 #if CTBOT_BUFFER_SIZE > 0
@@ -470,19 +1085,21 @@ bool CTBot::endQuery(const String& queryID, const String& message, bool alertMod
 #else
 	DynamicJsonBuffer jsonBuffer;
 #endif
-	JsonObject& root = jsonBuffer.parse(sendCommand(FSTR("answerCallbackQuery"), parameters));
+	JsonObject& root = jsonBuffer.parse(sendCommand(FSTR("answerCallbackQuery"), parameters, timeout));
 #elif ARDUINOJSON_VERSION_MAJOR == 6
 	DynamicJsonDocument root(CTBOT_JSON6_BUFFER_SIZE);
-	DeserializationError error = deserializeJson(root, sendCommand(FSTR("answerCallbackQuery"), parameters));
+	DeserializationError error = deserializeJson(root, sendCommand(FSTR("answerCallbackQuery"), parameters, timeout));
 	if (error) {
 		serialLog(FSTR("getNewMessage error: ArduinoJson deserialization error code: "), CTBOT_DEBUG_JSON);
 		serialLog(error.c_str(), CTBOT_DEBUG_JSON);
 		serialLog("\n", CTBOT_DEBUG_JSON);
+		setRequestError(CTBotRequestParseError);
 		return CTBotMessageNoData;
 	}
 #endif
 
 	if (!root[FSTR("ok")]) {
+		setAPIError(root[FSTR("error_code")].as<int>());
 #if (CTBOT_DEBUG_MODE & CTBOT_DEBUG_JSON) > 0
 		serialLog(FSTR("answerCallbackQuery error: "), CTBOT_DEBUG_JSON);
 #if ARDUINOJSON_VERSION_MAJOR == 5
@@ -532,6 +1149,178 @@ bool CTBot::removeReplyKeyboard(int64_t id, const String& message, bool selectiv
 	return sendMessage(id, message, command);
 }
 
+// ----------------------------| CONNECTION
+
+void CTBot::setDNSCacheTTL(uint32_t ttl)
+{
+	m_connection.setDNSCacheTTL(ttl);
+}
+
+bool CTBot::addFallbackIP(const String& ip)
+{
+	return(m_connection.addFallbackIP(ip));
+}
+
+void CTBot::clearFallbackIPs(void)
+{
+	m_connection.clearFallbackIPs();
+}
+
+bool CTBot::setCipherSuites(const uint16_t* suites, uint8_t count)
+{
+	return(m_connection.setCipherSuites(suites, count));
+}
+
+bool CTBot::setServerKeyPin(const char* pin)
+{
+	return(m_connection.setServerKeyPin(pin));
+}
+
+// ----------------------------| WEBHOOK
+
+bool CTBot::startWebhook(uint16_t port, const String& path, const String& secretToken)
+{
+	return(m_webhook.begin(port, path, secretToken));
+}
+
+void CTBot::stopWebhook(void)
+{
+	m_webhook.end();
+}
+
+bool CTBot::setWebhook(const String& url, const String& secretToken, uint32_t timeout)
+{
+	CTBotHeapScope heapScope(m_metrics, CTBotApiOther);
+
+	if (0 == url.length())
+		return false;
+
+	String parameters = (String)FSTR("?url=") + URLEncodeMessage(url) +
+		(String)FSTR("&allowed_updates=[\"message\",\"callback_query\"]");
+	if (secretToken.length() != 0)
+		parameters += (String)FSTR("&secret_token=") + secretToken;
+
+	String response = sendCommand(FSTR("setWebhook"), parameters, timeout, true);
+	if (0 == response.length())
+		return false;
+
+	CTBotRequestStatus status = checkResponsePrefix(response);
+	if (status != CTBotRequestOK) {
+		setRequestError(status);
+		return false;
+	}
+	return true;
+}
+
+bool CTBot::deleteWebhook(uint32_t timeout)
+{
+	CTBotHeapScope heapScope(m_metrics, CTBotApiOther);
+
+	String response = sendCommand(FSTR("deleteWebhook"), "", timeout, true);
+	if (0 == response.length())
+		return false;
+
+	CTBotRequestStatus status = checkResponsePrefix(response);
+	if (status != CTBotRequestOK) {
+		setRequestError(status);
+		return false;
+	}
+	return true;
+}
+
+// ----------------------------| POLLING
+
+void CTBot::setPollInterval(uint32_t minInterval, uint32_t maxInterval)
+{
+	m_poller.setIntervals(minInterval, maxInterval);
+}
+
+void CTBot::setLowPowerMode(CTBotSleepMode mode)
+{
+	m_lowPower.setMode(mode);
+}
+
+// ----------------------------| WIFI CONNECTION MANAGER
+
+bool CTBot::addWifiNetwork(const String& ssid, const String& password, uint8_t priority)
+{
+	return(m_wifi.addNetwork(ssid, password, priority));
+}
+
+CTBotWifiState CTBot::handleWifi(void)
+{
+	return(m_wifi.handleConnection());
+}
+
+// ----------------------------| DIAGNOSTICS
+
+CTBotMetricsSnapshot CTBot::getMetrics(void)
+{
+	return(m_metrics.getSnapshot());
+}
+
+void CTBot::printMetrics(Print& out)
+{
+	m_metrics.printPrometheus(out);
+}
+
+void CTBot::resetMetrics(void)
+{
+	m_metrics.reset();
+	m_outbox.resetStats();
+	m_poller.resetStats();
+	m_lowPower.resetStats();
+}
+
+void CTBot::setHeapBudget(uint32_t budget)
+{
+	m_metrics.setHeapBudget(budget);
+}
+
+void CTBot::dumpTrace(Print& out)
+{
+	traceDump(out);
+}
+
+void CTBot::clearTrace(void)
+{
+	traceClear();
+}
+
+CTBotRequestStats CTBot::getLastRequestStats(void)
+{
+	return(m_connection.getLastRequestStats());
+}
+
+CTBotBroadcastStats CTBot::getLastBroadcastStats(void)
+{
+	return(m_broadcastStats);
+}
+
+CTBotOutboxStats CTBot::getOutboxStats(void)
+{
+	CTBotOutboxStats stats;
+	stats.coalesced = m_outbox.getCoalescedCount();
+	stats.dropped   = m_outbox.getDroppedCount();
+	stats.queued    = m_outbox.getCount();
+	return(stats);
+}
+
+CTBotPollStats CTBot::getPollStats(void)
+{
+	return(m_poller.getStats());
+}
+
+CTBotSleepStats CTBot::getSleepStats(void)
+{
+	return(m_lowPower.getStats());
+}
+
+CTBotWifiStats CTBot::getWifiStats(void)
+{
+	return(m_wifi.getStats());
+}
+
 // ----------------------------| STUBS - FOR BACKWARD VERSION COMPATIBILITY
 
 void CTBot::setMaxConnectionRetries(uint8_t retries)
@@ -3,11 +3,19 @@
 #define CTBOT
 
 #include <Arduino.h>
+#include <FS.h>
 #include "CTBotDataStructures.h"
 #include "CTBotInlineKeyboard.h"
 #include "CTBotReplyKeyboard.h"
 #include "CTBotWifiSetup.h"
 #include "CTBotSecureConnection.h"
+#include "CTBotBatch.h"
+#include "CTBotOutbox.h"
+#include "CTBotState.h"
+#include "CTBotPollScheduler.h"
+#include "CTBotLowPower.h"
+#include "CTBotWebhook.h"
+#include "CTBotMetrics.h"
 #include "CTBotDefines.h"
 
 class CTBot
@@ -38,6 +46,76 @@ public:
 	//   true if no error occurred
 	bool wifiConnect(const String& ssid, const String& password = "");
 
+	// add a network to the non blocking WiFi connection manager, an alternative to wifiConnect().
+	// Once a network is added, getNewMessage() advances the connection manager (see handleWifi())
+	// and returns CTBotMessageNoData while the WiFi connection is not established
+	// params
+	//   ssid    : the SSID network identifier
+	//   password: the optional password
+	//   priority: the network rank: the available network with the highest priority is used,
+	//             networks with the same priority are ranked by signal strength
+	// returns
+	//   true if no error occurred (less than CTBOT_WIFI_MAX_NETWORKS networks)
+	bool addWifiNetwork(const String& ssid, const String& password = "", uint8_t priority = 0);
+
+	// advance the non blocking WiFi connection manager: scan, connect to the best known network,
+	// fail over to the next ones, back off and switch to a better access point. It never waits
+	// returns
+	//   the connection manager state (CTBotWifiConnected -> the WiFi connection is established)
+	CTBotWifiState handleWifi(void);
+
+	// start the webhook receiver: a small HTTP listener that takes the updates POSTed by the Telegram
+	// server, an alternative to the getUpdates polling. While the listener runs, getNewMessage()
+	// handles the pending requests and returns the received updates, without polling.
+	// The Telegram server sends the updates only over HTTPS: use a TLS terminating proxy
+	// (see setWebhook() to register the public URL)
+	// params
+	//   port       : the TCP port of the listener
+	//   path       : the request path accepted, i.e. "/" or "/telegram"
+	//   secretToken: if not empty, the requests must contain the same X-Telegram-Bot-Api-Secret-Token
+	//                header (the secretToken of setWebhook())
+	// returns
+	//   true if no error occurred
+	bool startWebhook(uint16_t port = CTBOT_WEBHOOK_PORT, const String& path = "/", const String& secretToken = "");
+
+	// stop the webhook receiver: getNewMessage() polls the Telegram server again (call deleteWebhook() too)
+	void stopWebhook(void);
+
+	// register the webhook URL on the Telegram server. While a webhook is set, getUpdates doesn't work
+	// params
+	//   url        : the public HTTPS URL of the webhook receiver (or of its proxy)
+	//   secretToken: the optional token the Telegram server sends in every request (1-256 characters A-Z, a-z, 0-9, _ and -)
+	//   timeout    : the request deadline, in milliseconds (zero -> CTBOT_REQUEST_TIMEOUT)
+	// returns
+	//   true if no error occurred
+	bool setWebhook(const String& url, const String& secretToken = "", uint32_t timeout = 0);
+
+	// remove the webhook from the Telegram server, so getUpdates works again
+	// params
+	//   timeout: the request deadline, in milliseconds (zero -> CTBOT_REQUEST_TIMEOUT)
+	// returns
+	//   true if no error occurred
+	bool deleteWebhook(uint32_t timeout = 0);
+
+	// set the bounds of the adaptive poll interval of the non blocking getNewMessage(). After an update
+	// the Telegram server is polled every minInterval milliseconds, every empty poll doubles the interval
+	// up to maxInterval. The same value for both gives a fixed interval
+	// Default values are CTBOT_POLL_INTERVAL_MIN (500 ms) and CTBOT_POLL_INTERVAL_MAX (10 seconds)
+	// params
+	//   minInterval: the poll interval after an update, in milliseconds (zero is raised to 1)
+	//   maxInterval: the max poll interval when idle, in milliseconds
+	void setPollInterval(uint32_t minInterval, uint32_t maxInterval);
+
+	// enable the low power polling: the radio sleeps between two polls of the non blocking getNewMessage()
+	// and the outbound queue is sent during the same wake window of the polls. Every other request
+	// wakes the radio for its own wake window. The access point
+	// association is kept through the sleep; every request opens a new connection (ESP8266: TLS session resumed)
+	// params
+	//   mode: CTBotSleepModem -> modem sleep between two polls
+	//         CTBotSleepLight -> light sleep between two polls (ESP8266 only, the ESP32 uses the modem sleep)
+	//         CTBotSleepNone  -> radio always on (default)
+	void setLowPowerMode(CTBotSleepMode mode);
+
 	// set how many times the wifiConnect method have to try to connect to the specified SSID.
 	// A value of zero mean infinite retries.
 	// Default value is zero (infinite retries)
@@ -58,6 +136,25 @@ public:
 	//          false -> use fixed IP addres
 	bool useDNS(bool value);
 
+	// set how long the resolved Telegram server address is cached. When the time is over, the name is
+	// resolved again (while the bot is idle in getNewMessage, or before the next request)
+	// Default value is CTBOT_DNS_CACHE_TTL (1 hour)
+	// params
+	//   ttl: the time to live, in seconds
+	void setDNSCacheTTL(uint32_t ttl);
+
+	// add a fallback IP for the Telegram server, used when the name resolution or the connection
+	// with the resolved address fail. The fallback IPs are tried in the same order they are added
+	// By default the list contains 149.154.167.220
+	// params
+	//   ip: the IP address (i.e. "149.154.167.220")
+	// returns
+	//   true if no error occurred (valid IP, less than CTBOT_MAX_FALLBACK_IPS addresses)
+	bool addFallbackIP(const String& ip);
+
+	// remove all the fallback IPs (the default one too)
+	void clearFallbackIPs(void);
+
 	// enable/disable the UTF8 encoding for the received message.
 	// Default value is false (disabled)
 	// param
@@ -72,7 +169,8 @@ public:
 	//   pin: the pin used for visual notification
 	void setStatusPin(int8_t pin);
 
-	// test the connection between ESP8266 and the telegram server
+	// test the connection between ESP8266 and the telegram server with a getMe round trip
+	// (the persisted bot identity is refreshed, never used as the answer)
 	// returns
 	//    true if no error occurred
 	bool testConnection(void);
@@ -82,14 +180,16 @@ public:
 	// so a new getMessage will read the next message (if any).
 	// params
 	//   message : the data structure that will contains the data retrieved
-	//   blocking: false -> execute the member function only every CTBOT_GET_UPDATE_TIMEOUT milliseconds
-	//                      with this trick the Telegram Server responds very quickly
+	//   blocking: false -> poll the Telegram server only when the adaptive poll interval has passed
+	//                      (see setPollInterval()): with this trick the Telegram Server responds very quickly
 	//             true  -> the old method, blocking the execution for aroun 3-4 second
+	//   timeout : the request deadline, in milliseconds (zero -> CTBOT_REQUEST_TIMEOUT). When it expires
+	//             the call returns CTBotMessageNoData and getLastStatus() returns CTBotRequestTimeout
 	// returns
 	//   CTBotMessageNoData: an error has occurred
 	//   CTBotMessageText  : the received message is a text
 	//   CTBotMessageQuery : the received message is a query (from inline keyboards)
-	CTBotMessageType getNewMessage(TBMessage &message, bool blocking = false);
+	CTBotMessageType getNewMessage(TBMessage &message, bool blocking = false, uint32_t timeout = 0);
 
 	// send a message to the specified telegram user ID
 	// params
@@ -97,11 +197,112 @@ public:
 	//   message : the message to send
 	//   keyboard: the inline/reply keyboard (optional)
 	//             (in json format or using the CTBotInlineKeyboard/CTBotReplyKeyboard class helper)
+	//   timeout : the request deadline, in milliseconds (zero -> CTBOT_REQUEST_TIMEOUT)
+	// A message too long for a single request is split (see sendLongMessage()): the keyboard is attached
+	// to the last message
 	// returns
-	//   the messageID if no errors occurred, otherwise 0
-	int32_t sendMessage(int64_t id, const String& message, const String& keyboard = "");
-	int32_t sendMessage(int64_t id, const String& message, CTBotInlineKeyboard &keyboard);
-	int32_t sendMessage(int64_t id, const String& message, CTBotReplyKeyboard  &keyboard);
+	//   the messageID (of the first message, if split) if no errors occurred, otherwise 0 (check
+	//   getLastStatus() for the reason)
+	int32_t sendMessage(int64_t id, const String& message, const String& keyboard = "", uint32_t timeout = 0);
+	int32_t sendMessage(int64_t id, const String& message, CTBotInlineKeyboard &keyboard, uint32_t timeout = 0);
+	int32_t sendMessage(int64_t id, const String& message, CTBotReplyKeyboard  &keyboard, uint32_t timeout = 0);
+
+	// send a message to the specified telegram user ID without parsing the response (fire-and-forget):
+	// only the beginning of the response ("ok":true) is checked, the rest is discarded. Faster and
+	// no JSON document is allocated, but the message ID is not available
+	// params
+	//   id      : the telegram recipient user ID 
+	//   message : the message to send
+	//   keyboard: the inline/reply keyboard (optional)
+	//   timeout : the request deadline, in milliseconds (zero -> CTBOT_REQUEST_TIMEOUT)
+	// returns
+	//   true if no error occurred (check getLastStatus() for the reason of a failure)
+	bool sendNotification(int64_t id, const String& message, const String& keyboard = "", uint32_t timeout = 0);
+	bool sendNotification(int64_t id, const String& message, CTBotInlineKeyboard &keyboard, uint32_t timeout = 0);
+	bool sendNotification(int64_t id, const String& message, CTBotReplyKeyboard  &keyboard, uint32_t timeout = 0);
+
+	// send a long text (i.e. a log dump) to the specified telegram user ID. The text is split in messages
+	// that fit the Telegram limits (CTBOT_MAX_MESSAGE_LENGTH characters, CTBOT_MAX_MESSAGE_URL_SIZE URL
+	// encoded bytes), on line boundaries when possible and never inside a UTF-8 character. The messages
+	// are sent in order, pipelined CTBOT_MAX_BATCH_SIZE at a time on the same connection
+	// params
+	//   id        : the telegram recipient user ID
+	//   message   : the text to send
+	//   messageIDs: an optional array that will contain the IDs of the sent messages
+	//   maxIDs    : the messageIDs array size
+	//   keyboard  : the inline/reply keyboard attached to the last message (optional)
+	//   timeout   : the deadline of every pipelined batch, in milliseconds (zero -> CTBOT_REQUEST_TIMEOUT)
+	// returns
+	//   the number of messages sent in order. The sending stops after the first batch with an error
+	//   (check getLastStatus() for the reason)
+	uint16_t sendLongMessage(int64_t id, const String& message, int32_t* messageIDs = NULL, uint16_t maxIDs = 0,
+		const String& keyboard = "", uint32_t timeout = 0);
+
+	// send a photo to the specified telegram user ID. The photo is streamed to the Telegram server
+	// (multipart/form-data) in CTBOT_UPLOAD_BUFFER_SIZE bytes pieces: the used memory doesn't depend on its size
+	// params
+	//   id      : the telegram recipient user ID
+	//   photo   : the photo content (i.e. a JPEG image), from any Stream or a LittleFS/SPIFFS File
+	//   size    : the photo size, in bytes. Zero -> unknown size: the photo ends when the stream has no more
+	//             bytes available (chunked transfer encoding)
+	//   fileName: the file name shown by the Telegram clients
+	//   caption : an optional caption
+	//   timeout : the request deadline, in milliseconds (zero -> CTBOT_REQUEST_TIMEOUT)
+	// returns
+	//   the messageID if no errors occurred, otherwise 0 (check getLastStatus() for the reason)
+	int32_t sendPhoto(int64_t id, Stream& photo, uint32_t size, const String& fileName = "photo.jpg", const String& caption = "", uint32_t timeout = 0);
+	int32_t sendPhoto(int64_t id, fs::File& photo, const String& caption = "", uint32_t timeout = 0);
+
+	// send a document (i.e. a CSV log) to the specified telegram user ID. The document is streamed like
+	// the photos (see sendPhoto())
+	// params
+	//   id      : the telegram recipient user ID
+	//   document: the document content, from any Stream or a LittleFS/SPIFFS File
+	//   size    : the document size, in bytes. Zero -> unknown size (chunked transfer encoding)
+	//   fileName: the file name shown by the Telegram clients
+	//   caption : an optional caption
+	//   timeout : the request deadline, in milliseconds (zero -> CTBOT_REQUEST_TIMEOUT)
+	// returns
+	//   the messageID if no errors occurred, otherwise 0 (check getLastStatus() for the reason)
+	int32_t sendDocument(int64_t id, Stream& document, uint32_t size, const String& fileName, const String& caption = "", uint32_t timeout = 0);
+	int32_t sendDocument(int64_t id, fs::File& document, const String& caption = "", uint32_t timeout = 0);
+
+	// get the info needed to download a file received with a message (i.e. TBMessage::document)
+	// params
+	//   fileID : the file identifier, i.e. message.document.fileID
+	//   file   : the structure that will contain the file info (see TBFile)
+	//   timeout: the request deadline, in milliseconds (zero -> CTBOT_REQUEST_TIMEOUT)
+	// returns
+	//   true if no error occurred (check getLastStatus() for the reason of a failure)
+	bool getFile(const String& fileID, TBFile& file, uint32_t timeout = 0);
+
+	// download a file into a sink (any Stream or a LittleFS/SPIFFS File) through a fixed buffer, so
+	// multi MB files can be downloaded. After a disconnection the download resumes where it stopped
+	// (HTTP Range request), up to CTBOT_DOWNLOAD_RETRIES attempts without progress
+	// params
+	//   file    : the file info, retrieved with getFile()
+	//   sink    : where to write the file
+	//   progress: an optional progress callback (see CTBotProgressCallback)
+	//   timeout : the deadline of every attempt, in milliseconds (zero -> no deadline)
+	// returns
+	//   the bytes written into the sink. The download is complete if getLastStatus() is CTBotRequestOK
+	uint32_t downloadFile(const TBFile& file, Stream& sink, CTBotProgressCallback progress = NULL, uint32_t timeout = 0);
+
+	// send the same message to many telegram user IDs. The message is URL encoded once, the requests are
+	// pipelined CTBOT_BROADCAST_BATCH_SIZE at a time on the same connection and the responses are not
+	// parsed (see sendNotification()). The sending rate is kept under CTBOT_BROADCAST_RATE messages per
+	// second and it slows down after a "429 Too Many Requests" error
+	// params
+	//   ids     : the telegram recipient user IDs
+	//   count   : the number of recipients
+	//   message : the message to send
+	//   results : an optional array (count elements) that will contain the result of every recipient
+	//   keyboard: the inline/reply keyboard (optional)
+	//   timeout : the deadline of every pipelined batch, in milliseconds (zero -> CTBOT_REQUEST_TIMEOUT)
+	// returns
+	//   the number of recipients that got the message (see getLastBroadcastStats() for the details)
+	uint16_t broadcastMessage(const int64_t* ids, uint16_t count, const String& message, CTBotRequestStatus* results = NULL,
+		const String& keyboard = "", uint32_t timeout = 0);
 
 	// edits text or inline keyboard of a previous message for the specified telegram user ID
 	// params
@@ -110,10 +311,11 @@ public:
 	//   message   : the new text
 	//   keyboard  : the inline/reply keyboard (optional)
 	//             (in json format or using the CTBotInlineKeyboard/CTBotReplyKeyboard class helper)
+	//   timeout   : the request deadline, in milliseconds (zero -> CTBOT_REQUEST_TIMEOUT)
 	// returns
-	//   true if no error occurred
-	bool editMessageText(int64_t id, int32_t messageID, const String& message, const String& keyboard = "");
-	bool editMessageText(int64_t id, int32_t messageID, const String& message, CTBotInlineKeyboard &keyboard);
+	//   true if no error occurred (check getLastStatus() for the reason of a failure)
+	bool editMessageText(int64_t id, int32_t messageID, const String& message, const String& keyboard = "", uint32_t timeout = 0);
+	bool editMessageText(int64_t id, int32_t messageID, const String& message, CTBotInlineKeyboard &keyboard, uint32_t timeout = 0);
 
 	// terminate a query started by pressing an inlineKeyboard button. The steps are:
 	// 1) send a message with an inline keyboard
@@ -124,7 +326,54 @@ public:
 	//   message  : an optional message
 	//   alertMode: false -> a simply popup message
 	//              true --> an alert message with ok button
-	bool endQuery(const String& queryID, const String& message = "", bool alertMode = false);
+	//   timeout  : the request deadline, in milliseconds (zero -> CTBOT_REQUEST_TIMEOUT)
+	// returns
+	//   true if no error occurred (check getLastStatus() for the reason of a failure)
+	bool endQuery(const String& queryID, const String& message = "", bool alertMode = false, uint32_t timeout = 0);
+
+	// send all the calls of a batch on the same connection: the requests are written back-to-back
+	// (pipelining) and the responses are read in order. The result of every call is stored in the batch
+	// params
+	//   batch  : the calls to send (see CTBotBatch)
+	//   timeout: the deadline of the whole batch, in milliseconds (zero -> CTBOT_REQUEST_TIMEOUT)
+	// returns
+	//   true if all the calls succeeded
+	bool sendBatch(CTBotBatch& batch, uint32_t timeout = 0);
+
+	// queue a message for the specified telegram user ID, without waiting for the Telegram server.
+	// The outbound queue is sent by getNewMessage() (or processOutbox()), higher priorities first,
+	// within the Telegram rate limits
+	// params
+	//   id      : the telegram recipient user ID
+	//   message : the message to send
+	//   priority: the message priority (i.e. CTBotPriorityHigh for alerts)
+	//   keyboard: the inline/reply keyboard in JSON format (optional)
+	// returns
+	//   true if the message was queued
+	bool queueMessage(int64_t id, const String& message, CTBotPriority priority = CTBotPriorityNormal, const String& keyboard = "");
+
+	// queue an edit of a previous message. A queued edit of the same message not yet sent is replaced
+	// by the new text, so only the latest text is sent
+	// params
+	//   id        : the telegram recipient user ID
+	//   messageID : the ID of the message to be edited
+	//   message   : the new text
+	//   priority  : the edit priority (i.e. CTBotPriorityLow for progress updates)
+	//   keyboard  : the inline keyboard in JSON format (optional)
+	// returns
+	//   true if the edit was queued
+	bool queueEditMessageText(int64_t id, int32_t messageID, const String& message, CTBotPriority priority = CTBotPriorityLow, const String& keyboard = "");
+
+	// send the next calls of the outbound queue: no more than one call for every chat and no more often
+	// than every CTBOT_OUTBOX_INTERVAL milliseconds. It is called by getNewMessage()
+	// returns
+	//   the number of calls successfully sent
+	uint8_t processOutbox(void);
+
+	// get how many calls are waiting in the outbound queue
+	// returns
+	//   the number of queued calls
+	uint8_t getOutboxCount(void);
 
 	// remove an active reply keyboard for a selected user, sending a message
 	// params:
@@ -144,24 +393,216 @@ public:
 	//    newFingerprint: the array of 20 bytes that contains the new fingerprint
 	void setFingerprint(const uint8_t *newFingerprint);
 
+	// set the preferred TLS cipher suites. The ECDHE-ECDSA suites need a lot less CPU time than the RSA ones
+	// (only for ESP8266: the ESP32 client doesn't allow to choose the cipher suites)
+	// params:
+	//    suites: the cipher suite IDs, from the most preferred to the least one
+	//    count : the number of cipher suites (max CTBOT_MAX_CIPHER_SUITES). Zero restores the default list
+	// returns:
+	//    true if no error occurred
+	bool setCipherSuites(const uint16_t* suites, uint8_t count);
+
+	// pin the Telegram server: the pin is checked instead of the certificate chain (or the fingerprint)
+	// params:
+	//    pin: ESP8266 -> the Telegram server public key, PEM format
+	//         ESP32   -> the SHA-256 fingerprint of the Telegram server certificate, hex format
+	//         NULL or an empty string removes the pin
+	// returns:
+	//    true if no error occurred (valid public key)
+	bool setServerKeyPin(const char* pin);
+
+	// get a snapshot of the collected metrics (requests, failures, bytes, latency histograms...)
+	// returns
+	//   a copy of the collected metrics
+	CTBotMetricsSnapshot getMetrics(void);
+
+	// print the collected metrics using the Prometheus text exposition format
+	// params:
+	//    out: where to print the metrics (i.e. Serial or a WiFiClient connected to the scraper)
+	void printMetrics(Print& out);
+
+	// clear all the collected metrics
+	void resetMetrics(void);
+
+	// set the max heap peak a single library call (getNewMessage, sendMessage...) can reach, from its beginning
+	// to its end, TLS buffers and JSON document included. The peak is the drop of the free heap sampled at
+	// the call boundaries and at the request sample points: it is not an allocation count. Every call over
+	// the budget is accounted in the heapBudgetExceeded metric: it is not an assertion, the call succeeds
+	// params:
+	//    budget: the heap budget, in bytes. Zero disables the check (default)
+	void setHeapBudget(uint32_t budget);
+
+	// write the hot path trace ring buffer content (binary format, see CTBotTrace.h) to a stream.
+	// Use extras/traceDecoder/ctbot_trace.py to decode it into a timeline
+	// params:
+	//    out: where to write the trace (i.e. Serial)
+	void dumpTrace(Print& out);
+
+	// clear the hot path trace ring buffer
+	void clearTrace(void);
+
+	// get the per phase timings (DNS, connect, send, first byte, transfer) and the byte counts
+	// of the last request sent to the Telegram server
+	// returns
+	//   the statistics of the last request
+	CTBotRequestStats getLastRequestStats(void);
+
+	// get the statistics of the last broadcast: duration, delivered messages, flood limit pauses...
+	// returns
+	//   the statistics of the last broadcast
+	CTBotBroadcastStats getLastBroadcastStats(void);
+
+	// get the statistics of the outbound queue: queued calls, merged edits, dropped calls
+	// returns
+	//   the outbound queue statistics
+	CTBotOutboxStats getOutboxStats(void);
+
+	// get the statistics of the adaptive poll scheduler: current interval, effective poll rate,
+	// average update wait time
+	// returns
+	//   the poll statistics
+	CTBotPollStats getPollStats(void);
+
+	// get the statistics of the low power polling: duty cycle, wake windows, estimated energy...
+	// returns
+	//   the low power statistics
+	CTBotSleepStats getSleepStats(void);
+
+	// get the statistics of the WiFi connections: duration of the last one, fast reconnections...
+	// returns
+	//   the WiFi connection statistics
+	CTBotWifiStats getWifiStats(void);
+
+	// get the result of the last request sent to the Telegram server
+	// returns
+	//   CTBotRequestOK           : no error
+	//   CTBotRequestNoConnection : unable to connect to the Telegram server
+	//   CTBotRequestTimeout      : the request deadline expired or the response was incomplete
+	//   CTBotRequestAPIError     : the Telegram server returned an error
+	//   CTBotRequestParseError   : the response is not a valid JSON
+	CTBotRequestStatus getLastStatus(void);
+
+	// get the current Telegram server time. The clock is synchronized with the "Date" header
+	// of every Telegram server response
+	// returns
+	//   the server time in Unix time, zero if the clock is not synchronized yet
+	uint32_t getServerTime(void);
+
+	// persist the bot state (the update offset and the bot identity) to a flash file system, so after
+	// a reboot the bot handles the new updates with the first request: no already handled updates
+	// received again. The offset is written every CTBOT_STATE_UPDATES updates or
+	// CTBOT_STATE_INTERVAL milliseconds, so up to CTBOT_STATE_UPDATES updates can be received again
+	// after an unexpected reset (call savePersistentState() before a planned one)
+	// Call it after setTelegramToken(): a state stored with a different token is discarded
+	// params
+	//   fs      : the file system (i.e. LittleFS), already mounted
+	//   fileName: the file used to store the state
+	// returns
+	//   true if a valid state was loaded (warm start)
+	bool setPersistence(fs::FS& fs, const String& fileName = CTBOT_STATE_FILE);
+
+	// write the unsaved bot state now (i.e. before a deep sleep, a restart or an OTA update)
+	// returns
+	//   true if no error occurred
+	bool savePersistentState(void);
+
 private:
 	CTBotSecureConnection m_connection;
 	CTBotWifiSetup        m_wifi;
+	CTBotMetrics          m_metrics;
+	CTBotOutbox           m_outbox;
+	CTBotState            m_state;               // persisted update offset and bot identity
+	uint32_t              m_outboxTimeStamp;     // millis() of the last outbound queue send
+	uint32_t              m_outboxInterval;      // min time before the next outbound queue send (longer after a 429)
 	uint8_t               m_wifiConnectionTries;
 	String                m_token;
 	int32_t               m_lastUpdate;
 	bool                  m_useDNS;
 	bool                  m_UTF8Encoding;
-	uint32_t              m_lastUpdateTimeStamp;
+	CTBotPollScheduler    m_poller;              // adaptive getUpdates interval
+	CTBotLowPower         m_lowPower;            // radio sleep between two polls
+	CTBotWebhook          m_webhook;             // webhook receiver, alternative to the polling
+	uint32_t              m_serverTime;          // last server time received, in Unix time
+	uint32_t              m_serverTimeStamp;     // millis() when m_serverTime was received
+	CTBotRequestStatus    m_lastStatus;          // result of the last request
+	CTBotBroadcastStats   m_broadcastStats;      // statistics of the last broadcast
 
 	// send commands to the telegram server. For info about commands, check the telegram api https://core.telegram.org/bots/api
 	// params
 	//   command   : the command to send, i.e. getMe
 	//   parameters: optional parameters
+	//   timeout   : the request deadline, in milliseconds (zero -> CTBOT_REQUEST_TIMEOUT)
+	//   discardBody: true -> only the beginning of the response is returned (see checkResponsePrefix())
 	// returns
 	//   an empty string if error
 	//   a string containing the Telegram JSON response
-	String sendCommand(const String& command, const String& parameters = "");
+	String sendCommand(const String& command, const String& parameters = "", uint32_t timeout = 0, bool discardBody = false);
+
+	// account the result of a request: last status, metrics and server time
+	// params
+	//   method   : the API method used by the request
+	//   startTime: millis() when the request started
+	//   received : true if a response was received
+	void endRequest(CTBotApiMethod method, uint32_t startTime, bool received);
+
+	// stream a file to the Telegram server (sendPhoto, sendDocument)
+	// params
+	//   command : the command to send, i.e. sendPhoto
+	//   field   : the form field of the file, i.e. photo
+	//   id      : the telegram recipient user ID
+	//   data    : the file content
+	//   size    : the file size, in bytes (zero -> unknown)
+	//   fileName: the file name
+	//   caption : an optional caption
+	//   timeout : the request deadline, in milliseconds (zero -> CTBOT_REQUEST_TIMEOUT)
+	// returns
+	//   the messageID if no errors occurred, otherwise 0
+	int32_t sendFile(const String& command, const String& field, int64_t id, Stream& data, uint32_t size,
+		const String& fileName, const String& caption, uint32_t timeout);
+
+	// get the message ID from a response like the sendMessage one, accounting the errors
+	// params
+	//   response: the Telegram JSON response
+	// returns
+	//   the message ID, zero if an error occurred
+	int32_t parseMessageID(const String& response);
+
+	// check the beginning of a Telegram response without parsing it: {"ok":true or
+	// {"ok":false,"error_code":<code>. An API error is accounted in the metrics
+	// params
+	//   response : the response (at least CTBOT_RESPONSE_PREFIX_SIZE bytes, if available)
+	//   errorCode: if not NULL, will contain the Telegram "error_code" (zero if no API error)
+	// returns
+	//   the result of the request
+	CTBotRequestStatus checkResponsePrefix(const String& response, int* errorCode = NULL);
+
+	// get the wait time asked by a "429 Too Many Requests" error
+	// params
+	//   response: the Telegram JSON response (or its prefix, see checkResponsePrefix())
+	// returns
+	//   the wait time in seconds, zero if not found
+	static uint16_t parseRetryAfter(const String& response);
+
+	// synchronize the server clock with the "Date" header of a response
+	// params
+	//   stats: the statistics of the request
+	void syncServerTime(const CTBotRequestStats& stats);
+
+	// account an error of the current request. Only the first error is kept: i.e. an empty response
+	// is a connection error, not a parse error
+	// params
+	//   status: the error
+	void setRequestError(CTBotRequestStatus status);
+
+	// account an error returned by the Telegram server ("ok": false)
+	// params
+	//   errorCode: the Telegram "error_code" field
+	void setAPIError(int errorCode);
+
+	// account the delivery lag of a received message (server time - message date)
+	// params
+	//   date: the message date, in Unix time
+	void trackDeliveryLag(int32_t date);
 
 	// convert an UNICODE string to UTF8 encoded string
 	// params
@@ -170,6 +611,21 @@ private:
 	//   a string with the converted message in UTF8 
 	String toUTF8(String message);
 
+	// get the next update received by the webhook receiver
+	// params
+	//   message: the data structure that will contains the data retrieved
+	// returns
+	//   the message type, CTBotMessageNoData if no update is queued
+	CTBotMessageType getWebhookMessage(TBMessage& message);
+
+	// decode an update (getUpdates result or webhook request body) into a message, updating the offset
+	// params
+	//   update : the update JSON object
+	//   message: the data structure that will contains the data retrieved
+	// returns
+	//   the message type, CTBotMessageNoData if the update isn't handled
+	CTBotMessageType parseUpdate(JsonVariant update, TBMessage& message);
+
 	// get some information about the bot
 	// params
 	//   user: the data structure that will contains the data retreived
@@ -0,0 +1,112 @@
+#include "CTBotBackground.h"
+
+#if defined(ARDUINO_ARCH_ESP32)
+
+#include "Utilities.h"
+
+CTBotBackground::CTBotBackground(CTBot& bot) : m_bot(bot) {
+	m_running      = false;
+	m_finished     = true;
+	m_sendFailures = 0;
+}
+
+CTBotBackground::~CTBotBackground() {
+	end();
+}
+
+bool CTBotBackground::begin(void) {
+	if (m_running)
+		return true;
+	m_running  = true;
+	m_finished = false;
+
+	// the Arduino loop() runs on ARDUINO_RUNNING_CORE: the network task uses the other one
+	if (xTaskCreatePinnedToCore(taskEntry, "CTBot", CTBOT_BACKGROUND_STACK_SIZE, this,
+		CTBOT_BACKGROUND_PRIORITY, NULL, CTBOT_BACKGROUND_CORE) != pdPASS) {
+		serialLog(FSTR("--- CTBotBackground: unable to create the task\n"), CTBOT_DEBUG_CONNECTION);
+		m_running  = false;
+		m_finished = true;
+		return false;
+	}
+	return true;
+}
+
+void CTBotBackground::end(void) {
+	if (!m_running && m_finished)
+		return;
+	m_running = false;
+	// the running request ends within its deadline
+	while (!m_finished)
+		delay(CTBOT_BACKGROUND_IDLE);
+}
+
+bool CTBotBackground::isRunning(void) {
+	return(m_running);
+}
+
+bool CTBotBackground::receive(TBMessage& message) {
+	return(m_received.pop(message));
+}
+
+bool CTBotBackground::send(int64_t id, const String& message, const String& keyboard) {
+	CTBotOutboundRequest request;
+	request.method    = CTBotApiSendMessage;
+	request.chatID    = id;
+	request.text      = message;
+	request.parameter = keyboard;
+	request.alertMode = false;
+	return(m_outbound.push(request));
+}
+
+bool CTBotBackground::endQuery(const String& queryID, const String& message, bool alertMode) {
+	CTBotOutboundRequest request;
+	request.method    = CTBotApiAnswerCallbackQuery;
+	request.chatID    = 0;
+	request.text      = message;
+	request.parameter = queryID;
+	request.alertMode = alertMode;
+	return(m_outbound.push(request));
+}
+
+uint32_t CTBotBackground::getSendFailures(void) {
+	return(m_sendFailures);
+}
+
+void CTBotBackground::taskEntry(void* parameter) {
+	CTBotBackground* background = (CTBotBackground*)parameter;
+	background->run();
+	background->m_finished = true;
+	vTaskDelete(NULL);
+}
+
+void CTBotBackground::run(void) {
+	CTBotOutboundRequest request;
+	TBMessage message;
+
+	while (m_running) {
+		bool busy = false;
+
+		// the answers first: they are what the users are waiting for
+		if (m_outbound.pop(request)) {
+			bool sent;
+			if (CTBotApiAnswerCallbackQuery == request.method)
+				sent = m_bot.endQuery(request.parameter, request.text, request.alertMode);
+			else
+				sent = (m_bot.sendMessage(request.chatID, request.text, request.parameter) != 0);
+			if (!sent)
+				m_sendFailures++;
+			busy = true;
+		}
+
+		// poll only if the message can be delivered: a fetched update is acknowledged by the next poll
+		if (!m_received.isFull() && (m_bot.getNewMessage(message) != CTBotMessageNoData)) {
+			m_received.push(message);
+			busy = true;
+		}
+
+		if (!busy)
+			delay(CTBOT_BACKGROUND_IDLE);
+	}
+}
+
+#endif
@@ -0,0 +1,93 @@
+#pragma once
+#ifndef CTBOT_BACKGROUND
+#define CTBOT_BACKGROUND
+
+#include "CTBot.h"
+
+// the background network task needs a second core: ESP32 only
+#if defined(ARDUINO_ARCH_ESP32)
+
+#include <atomic>
+#include "CTBotSPSCQueue.h"
+
+// outbound request queued for the background network task
+struct CTBotOutboundRequest {
+	CTBotApiMethod method;    // CTBotApiSendMessage or CTBotApiAnswerCallbackQuery
+	int64_t        chatID;    // sendMessage recipient
+	String         text;      // message text / callback query answer
+	String         parameter; // sendMessage keyboard / callback query ID
+	bool           alertMode; // callback query answer shown as an alert
+};
+
+// background network task: a dedicated FreeRTOS task, pinned to the core not used by the Arduino
+// loop(), runs all the bot networking, TLS and JSON parsing.
+// The received messages and the outbound requests are passed through two lock free single
+// producer / single consumer queues, so the sketch never waits for the network.
+// While the task runs, the sketch must use the CTBot object only through this class
+class CTBotBackground
+{
+public:
+	// params
+	//   bot: the bot, already configured (token, WiFi...)
+	CTBotBackground(CTBot& bot);
+	~CTBotBackground();
+
+	// start the background network task
+	// returns
+	//   true if no error occurred
+	bool begin(void);
+
+	// stop the background network task, waiting for the running request to end
+	void end(void);
+
+	// check if the background network task is running
+	bool isRunning(void);
+
+	// get the oldest message received by the background network task. It never waits
+	// params
+	//   message: the data structure that will contains the message
+	// returns
+	//   true if a message was available
+	bool receive(TBMessage& message);
+
+	// queue a message for the background network task. It never waits
+	// params
+	//   id      : the recipient ID
+	//   message : the message to send
+	//   keyboard: an optional keyboard (JSON, i.e. CTBotInlineKeyboard::getJSON())
+	// returns
+	//   false if the outbound queue is full
+	bool send(int64_t id, const String& message, const String& keyboard = "");
+
+	// queue a callback query answer for the background network task. It never waits
+	// params
+	//   queryID  : the unique query ID (TBMessage::callbackQueryID)
+	//   message  : an optional message
+	//   alertMode: false -> a simply popup message
+	//              true  -> an alert message with ok button
+	// returns
+	//   false if the outbound queue is full
+	bool endQuery(const String& queryID, const String& message = "", bool alertMode = false);
+
+	// get the number of outbound requests the Telegram server refused or that failed
+	uint32_t getSendFailures(void);
+
+private:
+	CTBot&                 m_bot;
+	std::atomic<bool>      m_running;  // cleared to stop the task
+	std::atomic<bool>      m_finished; // set by the task when it ends
+	std::atomic<uint32_t>  m_sendFailures;
+	CTBotSPSCQueue<TBMessage, CTBOT_BACKGROUND_RX_SIZE>            m_received; // task -> sketch
+	CTBotSPSCQueue<CTBotOutboundRequest, CTBOT_BACKGROUND_TX_SIZE> m_outbound; // sketch -> task
+
+	// the task entry point
+	// params
+	//   parameter: the CTBotBackground object
+	static void taskEntry(void* parameter);
+
+	// the task loop: send the outbound requests, poll the Telegram server
+	void run(void);
+};
+
+#endif
+#endif
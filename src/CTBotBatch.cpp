@@ -0,0 +1,83 @@
+#include "CTBotBatch.h"
+#include "Utilities.h"
+
+CTBotBatch::CTBotBatch() {
+	m_discardResponses = false;
+	clear();
+}
+
+void CTBotBatch::setDiscardResponses(bool discard) {
+	m_discardResponses = discard;
+}
+
+void CTBotBatch::clear(void) {
+	for (uint8_t i = 0; i < CTBOT_MAX_BATCH_SIZE; i++) {
+		m_parameters[i] = "";
+		m_status[i]     = CTBotRequestOK;
+		m_messageID[i]  = 0;
+		m_errorCode[i]  = 0;
+		m_retryAfter[i] = 0;
+	}
+	m_count = 0;
+}
+
+bool CTBotBatch::add(CTBotApiMethod method, const String& parameters) {
+	if (m_count >= CTBOT_MAX_BATCH_SIZE) {
+		serialLog(FSTR("CTBotBatch: batch full\n"), CTBOT_DEBUG_CONNECTION);
+		return false;
+	}
+	m_method[m_count]     = method;
+	m_parameters[m_count] = parameters;
+	m_status[m_count]     = CTBotRequestOK;
+	m_messageID[m_count]  = 0;
+	m_errorCode[m_count]  = 0;
+	m_retryAfter[m_count] = 0;
+	m_count++;
+	return true;
+}
+
+bool CTBotBatch::sendMessage(int64_t id, const String& message, const String& keyboard) {
+	if (0 == message.length())
+		return false;
+	return(add(CTBotApiSendMessage, sendMessageParameters(id, message, keyboard)));
+}
+
+bool CTBotBatch::sendMessage(int64_t id, const String& message, CTBotInlineKeyboard &keyboard) {
+	return(sendMessage(id, message, keyboard.getJSON()));
+}
+
+bool CTBotBatch::sendMessage(int64_t id, const String& message, CTBotReplyKeyboard &keyboard) {
+	return(sendMessage(id, message, keyboard.getJSON()));
+}
+
+bool CTBotBatch::editMessageText(int64_t id, int32_t messageID, const String& message, const String& keyboard) {
+	if (0 == message.length())
+		return false;
+	return(add(CTBotApiEditMessageText, editMessageTextParameters(id, messageID, message, keyboard)));
+}
+
+bool CTBotBatch::editMessageText(int64_t id, int32_t messageID, const String& message, CTBotInlineKeyboard &keyboard) {
+	return(editMessageText(id, messageID, message, keyboard.getJSON()));
+}
+
+bool CTBotBatch::endQuery(const String& queryID, const String& message, bool alertMode) {
+	if (0 == queryID.length())
+		return false;
+	return(add(CTBotApiAnswerCallbackQuery, answerCallbackQueryParameters(queryID, message, alertMode)));
+}
+
+uint8_t CTBotBatch::getCount(void) {
+	return(m_count);
+}
+
+CTBotRequestStatus CTBotBatch::getStatus(uint8_t index) {
+	if (index >= m_count)
+		return CTBotRequestNoConnection;
+	return(m_status[index]);
+}
+
+int32_t CTBotBatch::getMessageID(uint8_t index) {
+	if (index >= m_count)
+		return 0;
+	return(m_messageID[index]);
+}
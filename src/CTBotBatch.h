@@ -0,0 +1,88 @@
+#pragma once
+#ifndef CTBOT_BATCH
+#define CTBOT_BATCH
+
+#include <Arduino.h>
+#include "CTBotDataStructures.h"
+#include "CTBotInlineKeyboard.h"
+#include "CTBotReplyKeyboard.h"
+#include "CTBotMetrics.h"
+#include "CTBotDefines.h"
+
+// a list of Telegram API calls sent together by CTBot::sendBatch(): the requests are pipelined on
+// the same connection, so a multi-step interaction (i.e. editMessageText + endQuery + sendMessage)
+// costs about one round trip instead of one connection for every call
+class CTBotBatch
+{
+public:
+	CTBotBatch();
+
+	// remove all the calls and their results
+	void clear(void);
+
+	// add a sendMessage call. See CTBot::sendMessage()
+	// returns
+	//   true if no error occurred (valid message, batch not full)
+	bool sendMessage(int64_t id, const String& message, const String& keyboard = "");
+	bool sendMessage(int64_t id, const String& message, CTBotInlineKeyboard &keyboard);
+	bool sendMessage(int64_t id, const String& message, CTBotReplyKeyboard  &keyboard);
+
+	// add an editMessageText call. See CTBot::editMessageText()
+	// returns
+	//   true if no error occurred (valid message, batch not full)
+	bool editMessageText(int64_t id, int32_t messageID, const String& message, const String& keyboard = "");
+	bool editMessageText(int64_t id, int32_t messageID, const String& message, CTBotInlineKeyboard &keyboard);
+
+	// add an endQuery call. See CTBot::endQuery()
+	// returns
+	//   true if no error occurred (valid query ID, batch not full)
+	bool endQuery(const String& queryID, const String& message = "", bool alertMode = false);
+
+	// get how many calls are in the batch
+	// returns
+	//   the number of calls
+	uint8_t getCount(void);
+
+	// don't parse the responses (fire-and-forget): only the beginning of every response ("ok":true)
+	// is checked, the rest is discarded. Faster and no JSON document is allocated, but getMessageID()
+	// always returns zero. The setting is kept by clear()
+	// params
+	//   discard: true -> discard the responses
+	void setDiscardResponses(bool discard);
+
+	// get the result of a call, available after CTBot::sendBatch()
+	// params
+	//   index: the call index, in the same order they are added (from 0 to getCount() - 1)
+	// returns
+	//   the result of the call (see CTBotRequestStatus)
+	CTBotRequestStatus getStatus(uint8_t index);
+
+	// get the ID of the message sent/edited by a call, available after CTBot::sendBatch()
+	// params
+	//   index: the call index
+	// returns
+	//   the message ID, zero if an error occurred (or the call is an endQuery)
+	int32_t getMessageID(uint8_t index);
+
+private:
+	friend class CTBot;
+
+	CTBotApiMethod     m_method[CTBOT_MAX_BATCH_SIZE];
+	String             m_parameters[CTBOT_MAX_BATCH_SIZE];
+	CTBotRequestStatus m_status[CTBOT_MAX_BATCH_SIZE];
+	int32_t            m_messageID[CTBOT_MAX_BATCH_SIZE];
+	int                m_errorCode[CTBOT_MAX_BATCH_SIZE];  // Telegram "error_code", zero if no API error
+	uint16_t           m_retryAfter[CTBOT_MAX_BATCH_SIZE]; // seconds to wait after a "429 Too Many Requests"
+	uint8_t            m_count;
+	bool               m_discardResponses;
+
+	// add a call to the batch
+	// params
+	//   method    : the Telegram API method
+	//   parameters: the query string
+	// returns
+	//   true if the batch is not full
+	bool add(CTBotApiMethod method, const String& parameters);
+};
+
+#endif
@@ -9,7 +9,22 @@ enum CTBotMessageType {
 	CTBotMessageText     = 1,
 	CTBotMessageQuery    = 2,
 	CTBotMessageLocation = 3,
-	CTBotMessageContact  = 4
+	CTBotMessageContact  = 4,
+	CTBotMessageDocument = 5
+};
+
+enum CTBotRequestStatus {
+	CTBotRequestOK           = 0, // response received, no error returned by the Telegram server
+	CTBotRequestNoConnection = 1, // unable to connect to the Telegram server
+	CTBotRequestTimeout      = 2, // the request deadline expired or the response was incomplete
+	CTBotRequestAPIError     = 3, // the Telegram server returned an error ("ok": false)
+	CTBotRequestParseError   = 4  // the response is not a valid JSON
+};
+
+enum CTBotPriority {
+	CTBotPriorityHigh   = 0, // i.e. alerts
+	CTBotPriorityNormal = 1,
+	CTBotPriorityLow    = 2  // i.e. status/progress updates
 };
 
 struct TBUser {
@@ -39,6 +54,25 @@ struct TBContact {
 	String  vCard;
 };
 
+struct TBDocument {
+	String  fileID;
+	String  fileName;
+	String  mimeType;
+	int32_t fileSize;
+};
+
+struct TBFile {
+	String  fileID;
+	String  filePath; // path on the Telegram server, used to download the file
+	int32_t fileSize;
+};
+
+// download progress, called every time a piece of a file is written into the sink
+// params
+//   downloaded: the bytes downloaded so far
+//   total     : the file size, zero if unknown
+typedef void (*CTBotProgressCallback)(uint32_t downloaded, uint32_t total);
+
 
 struct TBMessage {
 	int32_t          messageID;
@@ -51,6 +85,7 @@ struct TBMessage {
 	String           callbackQueryID;
 	TBLocation       location;
 	TBContact        contact;
+	TBDocument       document;
 	CTBotMessageType messageType;
 };
 
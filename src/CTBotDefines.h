@@ -22,7 +22,11 @@
 #define CTBOT_CHECK_JSON                 1 // Check every JSON received from Telegram Server. Speedup the bot.
 										   // Zero -> Set it to zero if the bot doesn't receive messages anymore 
 										   //         slow down the bot
-#define CTBOT_GET_UPDATE_TIMEOUT      3500 // minimum time between two updates (getNewMessage) in milliseconds
+#define CTBOT_GET_UPDATE_TIMEOUT      3500 // fixed time between two updates of the old poll scheduler, in milliseconds
+										   // setPollInterval(CTBOT_GET_UPDATE_TIMEOUT, CTBOT_GET_UPDATE_TIMEOUT)
+										   // restores the old behavior
+#define CTBOT_POLL_INTERVAL_MIN        500 // time between two updates (getNewMessage) after an update, in ms
+#define CTBOT_POLL_INTERVAL_MAX      10000 // max time between two updates when the bot is idle, in ms
 
 // value for disabling the status pin. It is utilized for led notification on the board
 #define CTBOT_DISABLE_STATUS_PIN        -1
@@ -35,10 +39,96 @@
 
 // Platform specific defines: ESP8266 ----------------------------------------------------------------------------
 #define CTBOT_ESP8266_TCP_BUFFER_SIZE  512 // tx/rx wifiClientSecure buffer size for Telegram server connections
-										   // only for ESP8266
+										   // only for ESP8266. Used for the rx buffer only if the Telegram server
+										   // supports the TLS Max Fragment Length extension (512, 1024, 2048 or 4096)
+#define CTBOT_ESP8266_TLS_MAX_RX     16384 // rx buffer size needed when the server doesn't support the MFLN extension
+#define CTBOT_MAX_CIPHER_SUITES          8 // max number of preferred TLS cipher suites (only for ESP8266)
 
 // timeout used when try to connect to the telegram server
 #define CTBOT_CONNECTION_TIMEOUT      2000 // ms
+// connection timeout used with every candidate address but the last one: a slow or dead address
+// is abandoned early and the next one is tried (the last one gets CTBOT_CONNECTION_TIMEOUT)
+#define CTBOT_CONNECTION_STAGGER       750 // ms
+// default deadline of a whole request (name resolution, connection, request write and response read)
+#define CTBOT_REQUEST_TIMEOUT        10000 // ms (ESP32: the name resolution has its own fixed timeout and can go beyond it)
+
+#define CTBOT_DNS_CACHE_TTL           3600 // how long a resolved Telegram server address is used, in seconds
+#define CTBOT_DNS_RETRY_INTERVAL        60 // wait time before retrying a failed name resolution, in seconds
+#define CTBOT_WIFI_POLL_INTERVAL        10 // WiFi connection status poll interval, in ms
+#define CTBOT_WIFI_FAST_TIMEOUT       2000 // max time to reconnect to the cached access point (BSSID and channel)
+										   // before falling back to a full scan, in ms
+#define CTBOT_WIFI_REUSE_IP              1 // 1 -> the fast reconnect reuses the cached DHCP lease (no DHCP exchange)
+										   // 0 -> always ask the DHCP server
+#define CTBOT_WIFI_RTC_OFFSET           64 // ESP8266 RTC user memory block (4 bytes) where the access point is
+										   // cached (the first 32 blocks are used by the OTA update)
+
+#define CTBOT_WIFI_MAX_NETWORKS          4 // max number of networks known by the connection manager (CTBot::addWifiNetwork())
+#define CTBOT_WIFI_CONNECT_TIMEOUT   10000 // max time for a single access point connection or scan, in ms
+#define CTBOT_WIFI_SCAN_TTL          60000 // scan results reused before a new scan, in ms
+#define CTBOT_WIFI_BACKOFF_MIN        1000 // pause after a failed connection round, doubled at every failure, in ms
+#define CTBOT_WIFI_BACKOFF_MAX       60000 // max pause between two connection rounds, in ms
+#define CTBOT_WIFI_ROAM_INTERVAL     60000 // how often the connection manager looks for a better access point, in ms
+#define CTBOT_WIFI_ROAM_RSSI           -75 // look for a better access point only below this signal strength, in dBm
+#define CTBOT_WIFI_ROAM_HYSTERESIS      10 // min signal improvement to switch access point, in dB
+
+#define CTBOT_SLEEP_LISTEN_INTERVAL      3 // ESP8266 low power polling: DTIM beacons skipped by the sleeping radio
+#define CTBOT_POWER_AWAKE              230 // power used with the radio awake, in mW: energy estimate of the low power
+										   // polling statistics (ESP8266: about 70 mA at 3.3 V)
+#define CTBOT_POWER_MODEM_SLEEP         50 // power used during the modem sleep, in mW (about 15 mA at 3.3 V)
+#define CTBOT_POWER_LIGHT_SLEEP          3 // power used during the light sleep, in mW (about 1 mA at 3.3 V)
+
+#define CTBOT_MAX_FALLBACK_IPS           4 // max number of fallback IPs for the Telegram server
+#define CTBOT_MAX_ENDPOINTS (CTBOT_MAX_FALLBACK_IPS + 1) // the resolved address and the fallback IPs
+
+#define CTBOT_MAX_BATCH_SIZE             4 // max number of requests pipelined on the same connection (CTBotBatch)
+
+#define CTBOT_BROADCAST_BATCH_SIZE       8 // max number of broadcast requests pipelined on the same connection
+#define CTBOT_BROADCAST_RATE            25 // max broadcast messages per second (Telegram allows about 30 per
+										   // second to different chats)
+#define CTBOT_BROADCAST_BACKOFF       1000 // pause after a "429 Too Many Requests" error during a broadcast, in ms
+
+#define CTBOT_MAX_MESSAGE_LENGTH      4096 // max message length accepted by Telegram, in UTF-16 characters
+#define CTBOT_MAX_MESSAGE_URL_SIZE    6144 // max URL encoded message size sent in a single GET request
+										   // Longer messages are split (see CTBot::sendLongMessage())
+
+#define CTBOT_OUTBOX_SIZE                8 // max number of calls waiting in the outbound queue (CTBot::queueMessage())
+#define CTBOT_OUTBOX_INTERVAL         1000 // min time between two outbound queue sends, in ms (Telegram allows
+										   // about one message per second in the same chat)
+
+#define CTBOT_STATE_FILE     "/ctbot.dat" // default file used to persist the bot state (CTBot::setPersistence())
+#define CTBOT_STATE_UPDATES             16 // handled updates that trigger a state write: after a reboot, at most
+										   // this number of updates are received again
+#define CTBOT_STATE_INTERVAL         60000 // max time an update offset change stays unsaved, in ms
+
+#define CTBOT_WEBHOOK_PORT            8080 // default webhook listener port (CTBot::startWebhook())
+#define CTBOT_WEBHOOK_QUEUE_SIZE         4 // max number of webhook updates waiting for getNewMessage()
+#define CTBOT_WEBHOOK_MAX_BODY        4096 // max webhook request body size, in bytes (bigger updates are refused)
+#define CTBOT_WEBHOOK_READ_TIMEOUT    2000 // max time to read a webhook request, in ms
+
+#define CTBOT_BACKGROUND_RX_SIZE         8 // received messages waiting for the sketch (CTBotBackground, ESP32 only)
+#define CTBOT_BACKGROUND_TX_SIZE         8 // outbound requests waiting for the background network task
+// core of the background network task: the one not used by the Arduino loop() (single core chips: core 0)
+#if defined(CONFIG_FREERTOS_UNICORE)
+#define CTBOT_BACKGROUND_CORE            0
+#elif defined(ARDUINO_RUNNING_CORE)
+#define CTBOT_BACKGROUND_CORE (ARDUINO_RUNNING_CORE == 0 ? 1 : 0)
+#else
+#define CTBOT_BACKGROUND_CORE            0
+#endif
+#define CTBOT_BACKGROUND_PRIORITY        1 // FreeRTOS priority of the background network task
+#define CTBOT_BACKGROUND_STACK_SIZE   8192 // stack of the background network task, in bytes (TLS and JSON parsing)
+#define CTBOT_BACKGROUND_IDLE           10 // background network task pause when there is nothing to do, in ms
+
+#define CTBOT_READ_BUFFER_SIZE          64 // stack buffer used to read the response body from the Telegram server
+#define CTBOT_UPLOAD_BUFFER_SIZE       512 // stack buffer used to stream a file to the Telegram server (sendPhoto...)
+#define CTBOT_DOWNLOAD_BUFFER_SIZE     512 // stack buffer used to stream a file from the Telegram server (downloadFile)
+#define CTBOT_DOWNLOAD_RETRIES           3 // download attempts without progress before giving up (resumed with Range)
+#define CTBOT_RESPONSE_PREFIX_SIZE      96 // response body bytes kept by the fire-and-forget requests, the rest
+										   // is discarded (enough for {"ok":false,"error_code":429,"description":
+										   // "Too Many Requests: retry after <seconds>")
+
+#define CTBOT_TRACE_SIZE                64 // hot path events stored in the trace ring buffer (8 bytes each)
+										   // Zero -> trace disabled, no memory used
 
 // strings on FLASH macro
 #if defined(ARDUINO_ARCH_ESP8266) // ESP8266 
@@ -46,6 +136,9 @@
 #elif defined(ARDUINO_ARCH_ESP32) // ESP32
 // ESP32 does not support strings on FLASH
 #define FSTR(x) (x)
+#else
+// host build of the board independent classes (extras/test)
+#define FSTR(x) (x)
 #endif
 
 
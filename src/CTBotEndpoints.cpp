@@ -0,0 +1,102 @@
+#if defined(ARDUINO_ARCH_ESP8266) // ESP8266
+#include <ESP8266WiFi.h>
+#elif defined(ARDUINO_ARCH_ESP32) // ESP32
+#include <WiFi.h>
+#endif
+#include "CTBotEndpoints.h"
+#include "Utilities.h"
+
+CTBotEndpoints::CTBotEndpoints() {
+	m_resolvedValid     = false;
+	m_resolvedTimeStamp = 0;
+	m_lookupTimeStamp   = 0;
+	m_lookupFailed      = false;
+	m_ttl               = (uint32_t)CTBOT_DNS_CACHE_TTL * 1000;
+	m_fallbackCount     = 0;
+	m_preferred         = 0; // the resolved address
+}
+
+void CTBotEndpoints::setTTL(uint32_t ttl) {
+	m_ttl = ttl * 1000;
+}
+
+bool CTBotEndpoints::addFallbackIP(const String& ip) {
+	if (m_fallbackCount >= CTBOT_MAX_FALLBACK_IPS)
+		return false;
+	if (!m_fallbackIP[m_fallbackCount].fromString(ip))
+		return false;
+	m_fallbackCount++;
+	return true;
+}
+
+void CTBotEndpoints::clearFallbackIPs() {
+	m_fallbackCount = 0;
+	m_preferred     = 0;
+}
+
+bool CTBotEndpoints::needsResolution() {
+	// a failed resolution is retried after CTBOT_DNS_RETRY_INTERVAL seconds
+	if (m_lookupFailed && ((millis() - m_lookupTimeStamp) < (uint32_t)CTBOT_DNS_RETRY_INTERVAL * 1000))
+		return false;
+	if (!m_resolvedValid)
+		return true;
+	return((millis() - m_resolvedTimeStamp) >= m_ttl);
+}
+
+bool CTBotEndpoints::resolve(const String& host, uint32_t timeout) {
+	IPAddress address;
+
+	m_lookupTimeStamp = millis();
+#if defined(ARDUINO_ARCH_ESP8266)
+	bool resolved = WiFi.hostByName(host.c_str(), address, timeout);
+#else
+	(void)timeout;
+	bool resolved = WiFi.hostByName(host.c_str(), address);
+#endif
+	if (!resolved) {
+		serialLog(FSTR("\nUnable to resolve the Telegram server name\n"), CTBOT_DEBUG_CONNECTION);
+		m_lookupFailed = true;
+		return false;
+	}
+
+	m_lookupFailed      = false;
+	m_resolvedIP        = address;
+	m_resolvedValid     = true;
+	m_resolvedTimeStamp = m_lookupTimeStamp;
+	return true;
+}
+
+// candidate ids: 0 -> the resolved address, 1..CTBOT_MAX_FALLBACK_IPS -> the fallback IPs
+bool CTBotEndpoints::isAvailable(uint8_t candidate, bool useResolved) {
+	if (0 == candidate)
+		return(useResolved && m_resolvedValid);
+	return(candidate <= m_fallbackCount);
+}
+
+uint8_t CTBotEndpoints::getCandidates(uint8_t* candidates, bool useResolved) {
+	uint8_t count = 0;
+	if (isAvailable(m_preferred, useResolved))
+		candidates[count++] = m_preferred;
+	for (uint8_t i = 0; i <= m_fallbackCount; i++) {
+		if ((i != m_preferred) && isAvailable(i, useResolved))
+			candidates[count++] = i;
+	}
+	return count;
+}
+
+IPAddress CTBotEndpoints::getAddress(uint8_t candidate) {
+	if (0 == candidate)
+		return m_resolvedIP;
+	return m_fallbackIP[candidate - 1];
+}
+
+void CTBotEndpoints::reportFailure(uint8_t candidate) {
+	if (0 == candidate)
+		m_resolvedValid = false;
+	if (candidate == m_preferred)
+		m_preferred = 0;
+}
+
+void CTBotEndpoints::reportSuccess(uint8_t candidate) {
+	m_preferred = candidate;
+}
@@ -0,0 +1,89 @@
+#pragma once
+#ifndef CTBOTENDPOINTS
+#define CTBOTENDPOINTS
+
+#include <Arduino.h>
+#include <IPAddress.h>
+#include "CTBotDefines.h"
+
+// list of the Telegram server addresses used to connect: the resolved address of the Telegram
+// server (cached for a TTL) followed by the fallback IPs
+class CTBotEndpoints
+{
+public:
+	// default constructor
+	CTBotEndpoints();
+
+	// set how long a resolved address is valid
+	// params
+	//   ttl: the time to live, in seconds
+	void setTTL(uint32_t ttl);
+
+	// add a fallback IP, used when the name resolution or the connection with the resolved address fail
+	// params
+	//   ip: the IP address (i.e. "149.154.167.220")
+	// returns
+	//   true if no error occurred (valid IP, list not full)
+	bool addFallbackIP(const String& ip);
+
+	// remove all the fallback IPs
+	void clearFallbackIPs();
+
+	// check if the cached address must be resolved before connecting (no valid address or TTL expired)
+	// returns
+	//   true if a name resolution is needed
+	bool needsResolution();
+
+	// resolve the Telegram server name, caching the result. If the resolution fails, the old address
+	// (if any) is kept and no other resolution is made for CTBOT_DNS_RETRY_INTERVAL seconds
+	// params
+	//   host   : the Telegram server name
+	//   timeout: max time to wait for the DNS server, in milliseconds (ESP8266 only: the ESP32
+	//            resolver has its own fixed timeout)
+	// returns
+	//   true if the name was resolved
+	bool resolve(const String& host, uint32_t timeout);
+
+	// get the addresses that can be used to connect, sorted by preference: the address of the last
+	// successful connection first, then the resolved address, then the fallback IPs
+	// params
+	//   candidates : the array that will contain the candidate ids (CTBOT_MAX_ENDPOINTS items)
+	//   useResolved: false -> don't include the resolved address (fixed IP only)
+	// returns
+	//   the number of candidates
+	uint8_t getCandidates(uint8_t* candidates, bool useResolved);
+
+	// get the address of a candidate
+	// params
+	//   candidate: the candidate id returned by getCandidates()
+	// returns
+	//   the address
+	IPAddress getAddress(uint8_t candidate);
+
+	// report a failed connection to a candidate. A failed resolved address is dropped, so
+	// the next request resolves the name again instead of sticking to a stale address
+	// params
+	//   candidate: the candidate id
+	void reportFailure(uint8_t candidate);
+
+	// report a successful connection to a candidate: it will be the first one tried by the next requests
+	// params
+	//   candidate: the candidate id
+	void reportSuccess(uint8_t candidate);
+
+private:
+	IPAddress m_resolvedIP;
+	bool      m_resolvedValid;
+	uint32_t  m_resolvedTimeStamp;  // millis() of the last successful resolution
+	uint32_t  m_lookupTimeStamp;    // millis() of the last resolution attempt
+	bool      m_lookupFailed;
+	uint32_t  m_ttl;                // ms
+	IPAddress m_fallbackIP[CTBOT_MAX_FALLBACK_IPS];
+	uint8_t   m_fallbackCount;
+	uint8_t   m_preferred;          // candidate id of the last successful connection
+
+	// check if a candidate can be used
+	bool isAvailable(uint8_t candidate, bool useResolved);
+};
+
+#endif
@@ -0,0 +1,134 @@
+#include "CTBotLowPower.h"
+
+#if defined(ARDUINO_ARCH_ESP8266) // ESP8266
+#include <ESP8266WiFi.h>
+#elif defined(ARDUINO_ARCH_ESP32) // ESP32
+#include <WiFi.h>
+#endif
+
+CTBotLowPower::CTBotLowPower() {
+	m_mode      = CTBotSleepNone;
+	m_awake     = true;
+	m_wakeDepth = 0;
+	resetStats();
+}
+
+void CTBotLowPower::setMode(CTBotSleepMode mode) {
+	if (mode == m_mode)
+		return;
+	// the current period belongs to the old mode: account it before the change
+	bool wasEnabled = (m_mode != CTBotSleepNone);
+	if (wasEnabled) {
+		if (m_awake)
+			m_awakeTime += millis() - m_timeStamp;
+		else
+			m_sleepTime += millis() - m_timeStamp;
+	}
+	m_mode      = mode;
+	m_timeStamp = millis();
+	if (CTBotSleepNone == mode) {
+		setRadioSleep(false);
+		m_awake = true;
+		return;
+	}
+	if (m_wakeDepth > 0) {
+		// called inside a wake window: the radio sleeps when the window ends
+		if (!wasEnabled)
+			m_wakes++;
+		m_awake = true;
+		return;
+	}
+	// start sleeping: the first wake window starts with the next poll
+	setRadioSleep(true);
+	m_awake = false;
+}
+
+bool CTBotLowPower::isEnabled(void) {
+	return(m_mode != CTBotSleepNone);
+}
+
+void CTBotLowPower::wake(void) {
+	if (m_wakeDepth++ > 0)
+		return;
+	if ((CTBotSleepNone == m_mode) || m_awake)
+		return;
+	m_sleepTime += millis() - m_timeStamp;
+	m_timeStamp  = millis();
+	m_awake      = true;
+	m_wakes++;
+	setRadioSleep(false);
+}
+
+void CTBotLowPower::sleep(void) {
+	if ((0 == m_wakeDepth) || (--m_wakeDepth > 0))
+		return;
+	if ((CTBotSleepNone == m_mode) || !m_awake)
+		return;
+	m_lastWakeTime = millis() - m_timeStamp;
+	m_awakeTime   += m_lastWakeTime;
+	m_timeStamp    = millis();
+	m_awake        = false;
+	setRadioSleep(true);
+}
+
+void CTBotLowPower::addUpdate(void) {
+	if (m_mode != CTBotSleepNone)
+		m_updates++;
+}
+
+CTBotSleepStats CTBotLowPower::getStats(void) {
+	CTBotSleepStats stats;
+	stats.wakes        = m_wakes;
+	stats.updates      = m_updates;
+	stats.awakeTime    = m_awakeTime;
+	stats.sleepTime    = m_sleepTime;
+	stats.lastWakeTime = m_lastWakeTime;
+	// the current period is accounted too
+	if (m_mode != CTBotSleepNone) {
+		if (m_awake)
+			stats.awakeTime += millis() - m_timeStamp;
+		else
+			stats.sleepTime += millis() - m_timeStamp;
+	}
+	uint32_t total = stats.awakeTime + stats.sleepTime;
+	stats.dutyCycle = (0 == total) ? 0 : (uint16_t)((uint64_t)stats.awakeTime * 1000 / total);
+	stats.averageWakeTime = (0 == m_wakes) ? 0 : m_awakeTime / m_wakes;
+
+	// energy estimate: milliseconds * milliwatts / 1000 -> millijoules
+	uint32_t sleepPower = (CTBotSleepLight == m_mode) ? CTBOT_POWER_LIGHT_SLEEP : CTBOT_POWER_MODEM_SLEEP;
+	uint64_t awakeEnergy = (uint64_t)stats.awakeTime * CTBOT_POWER_AWAKE / 1000;
+	stats.energy = (uint32_t)(awakeEnergy + (uint64_t)stats.sleepTime * sleepPower / 1000);
+	stats.averageWakeEnergy = (0 == m_wakes) ? 0 : (uint32_t)((uint64_t)m_awakeTime * CTBOT_POWER_AWAKE / 1000 / m_wakes);
+	return(stats);
+}
+
+void CTBotLowPower::resetStats(void) {
+	m_timeStamp    = millis();
+	m_wakes        = 0;
+	m_updates      = 0;
+	m_awakeTime    = 0;
+	m_sleepTime    = 0;
+	m_lastWakeTime = 0;
+}
+
+void CTBotLowPower::setRadioSleep(bool sleep) {
+#if defined(ARDUINO_ARCH_ESP8266) // ESP8266
+	if (!sleep)
+		WiFi.setSleepMode(WIFI_NONE_SLEEP);
+	else if (CTBotSleepLight == m_mode)
+		WiFi.setSleepMode(WIFI_LIGHT_SLEEP, CTBOT_SLEEP_LISTEN_INTERVAL);
+	else
+		WiFi.setSleepMode(WIFI_MODEM_SLEEP, CTBOT_SLEEP_LISTEN_INTERVAL);
+#elif defined(ARDUINO_ARCH_ESP32) // ESP32
+	// the ESP32 WiFi library exposes the modem sleep only
+	WiFi.setSleep(sleep);
+#endif
+}
+
+CTBotWakeScope::CTBotWakeScope(CTBotLowPower& lowPower) : m_lowPower(lowPower) {
+	m_lowPower.wake();
+}
+
+CTBotWakeScope::~CTBotWakeScope() {
+	m_lowPower.sleep();
+}
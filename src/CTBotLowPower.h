@@ -0,0 +1,80 @@
+#pragma once
+#ifndef CTBOT_LOW_POWER
+#define CTBOT_LOW_POWER
+
+#include <Arduino.h>
+#include "CTBotMetrics.h"
+#include "CTBotDefines.h"
+
+// radio power saving between two polls (CTBot::setLowPowerMode())
+enum CTBotSleepMode {
+	CTBotSleepNone  = 0, // radio always on (default)
+	CTBotSleepModem = 1, // modem sleep: the radio wakes up at every DTIM beacon
+	CTBotSleepLight = 2  // light sleep: modem sleep, the CPU sleeps too while idle (ESP8266 only)
+};
+
+// low power polling: the radio sleeps between two polls and stays awake only during the wake
+// windows (poll + outbound queue, or a request sent by the sketch). The access point association is kept
+// (no reassociation nor DHCP), but every request opens its own connection: on ESP8266 it resumes the
+// TLS session (abbreviated handshake), on ESP32 it does a full handshake
+class CTBotLowPower
+{
+public:
+	CTBotLowPower();
+
+	// set the sleep mode used between two wake windows
+	// params
+	//   mode: the sleep mode. CTBotSleepNone disables the low power polling
+	void setMode(CTBotSleepMode mode);
+
+	// check if the low power polling is enabled
+	bool isEnabled(void);
+
+	// start a wake window: the radio is always on until sleep(). Nested windows (i.e. a request
+	// sent by the poll) are part of the outer one
+	void wake(void);
+
+	// end the wake window: the radio goes back to sleep when the outer window ends
+	void sleep(void);
+
+	// account an update fetched during the current wake window
+	void addUpdate(void);
+
+	// get the low power statistics
+	// returns
+	//   the statistics since the last resetStats()
+	CTBotSleepStats getStats(void);
+
+	// clear the statistics
+	void resetStats(void);
+
+private:
+	CTBotSleepMode m_mode;
+	bool           m_awake;
+	uint8_t        m_wakeDepth;  // nested wake windows
+	uint32_t       m_timeStamp;  // millis() of the last wake() or sleep()
+	uint32_t       m_wakes;
+	uint32_t       m_updates;
+	uint32_t       m_awakeTime;
+	uint32_t       m_sleepTime;
+	uint32_t       m_lastWakeTime;
+
+	// set the radio power saving mode
+	// params
+	//   sleep: true -> m_mode, false -> radio always on
+	void setRadioSleep(bool sleep);
+};
+
+// a wake window: the radio is woken when the object is created and
+// goes back to sleep when the object is destroyed (the call returns)
+class CTBotWakeScope
+{
+public:
+	CTBotWakeScope(CTBotLowPower& lowPower);
+	~CTBotWakeScope();
+
+private:
+	CTBotLowPower& m_lowPower;
+};
+
+#endif
@@ -0,0 +1,274 @@
+#include "CTBotMetrics.h"
+#include "Utilities.h"
+
+// histogram buckets upper bound, in milliseconds. The last bucket is "+Inf"
+static const uint32_t latencyBounds[CTBOT_HISTOGRAM_BUCKETS - 1] = { 50, 100, 250, 500, 1000, 2500, 5000 };
+static const uint32_t lagBounds[CTBOT_HISTOGRAM_BUCKETS - 1]     = { 1000, 2000, 5000, 10000, 30000, 60000, 300000 };
+
+// Telegram API method names, used as Prometheus label
+static const char* apiMethodNames[CTBotApiMethodCount] = {
+	"getMe", "getUpdates", "sendMessage", "editMessageText", "answerCallbackQuery", "other" };
+
+// request phase names, used as Prometheus label
+static const char* phaseNames[CTBotPhaseCount] = {
+	"dns", "connect", "send", "first_byte", "transfer" };
+
+CTBotMetrics::CTBotMetrics() {
+	m_heapBudget    = 0; // no heap budget check
+	m_callDepth     = 0;
+	m_callStartHeap = 0;
+	m_callMinHeap   = 0;
+	reset();
+}
+
+void CTBotMetrics::reset() {
+	memset(&m_data, 0, sizeof(m_data));
+	m_data.minFreeHeap  = ESP.getFreeHeap();
+	m_data.minFreeBlock = getMaxFreeBlockSize();
+}
+
+void CTBotMetrics::addRequest(CTBotApiMethod method, uint32_t elapsed, bool success, const CTBotRequestStats& stats) {
+	if (method >= CTBotApiMethodCount)
+		method = CTBotApiOther;
+
+	m_data.requests++;
+	m_data.bytesOut += stats.bytesOut;
+	m_data.bytesIn  += stats.bytesIn;
+	if (!success)
+		m_data.failures++;
+	if (stats.timedOut)
+		m_data.timeouts++;
+	if (stats.deadlineExpired)
+		m_data.deadlineExpired++;
+	if (stats.connectAttempts > 1)
+		m_data.connectFallbacks++;
+	addSample(m_data.latency[method], elapsed, latencyBounds);
+
+	// a phase that was not reached is not accounted (the DNS phase is skipped when using the fixed IP,
+	// the connect phase is skipped by the pipelined requests that reuse the connection)
+	if (stats.resolved)
+		addSample(m_data.phase[CTBotPhaseDNS], stats.dnsTime, latencyBounds);
+	if (stats.connectAttempts > 0)
+		addSample(m_data.phase[CTBotPhaseConnect], stats.connectTime, latencyBounds);
+	if (stats.handshakeTime > 0)
+		addSample(m_data.handshake, stats.handshakeTime, latencyBounds);
+	if (stats.bytesOut > 0)
+		addSample(m_data.phase[CTBotPhaseSend], stats.sendTime, latencyBounds);
+	if (stats.bytesIn > 0) {
+		addSample(m_data.phase[CTBotPhaseFirstByte], stats.firstByteTime, latencyBounds);
+		addSample(m_data.phase[CTBotPhaseTransfer], stats.transferTime, latencyBounds);
+	}
+	if (stats.minFreeHeap > 0)
+		sampleHeap(stats.minFreeHeap, stats.minFreeBlock);
+	sampleHeap();
+}
+
+void CTBotMetrics::addAPIError(int errorCode) {
+	// no error code -> no response at all, already accounted by addRequest
+	if (0 == errorCode)
+		return;
+	m_data.failures++;
+	if (429 == errorCode)
+		m_data.tooManyRequests++;
+}
+
+void CTBotMetrics::addUpdate() {
+	m_data.updatesReceived++;
+	sampleHeap();
+}
+
+void CTBotMetrics::addDeliveryLag(uint32_t lag) {
+	if ((0 == m_data.deliveryLag.count) || (lag < m_data.deliveryLagMin))
+		m_data.deliveryLagMin = lag;
+	if (lag > m_data.deliveryLagMax)
+		m_data.deliveryLagMax = lag;
+	addSample(m_data.deliveryLag, lag, lagBounds);
+}
+
+void CTBotMetrics::sampleHeap() {
+	sampleHeap(ESP.getFreeHeap(), getMaxFreeBlockSize());
+}
+
+void CTBotMetrics::sampleHeap(uint32_t freeHeap, uint32_t freeBlock) {
+	if (freeHeap < m_data.minFreeHeap)
+		m_data.minFreeHeap = freeHeap;
+	if (freeBlock < m_data.minFreeBlock)
+		m_data.minFreeBlock = freeBlock;
+	if ((m_callDepth > 0) && (freeHeap < m_callMinHeap))
+		m_callMinHeap = freeHeap;
+}
+
+void CTBotMetrics::setHeapBudget(uint32_t budget) {
+	m_heapBudget = budget;
+}
+
+void CTBotMetrics::beginCall() {
+	if (m_callDepth++ > 0)
+		return;
+	m_callStartHeap = ESP.getFreeHeap();
+	m_callMinHeap   = m_callStartHeap;
+}
+
+void CTBotMetrics::endCall(CTBotApiMethod method) {
+	if ((0 == m_callDepth) || (--m_callDepth > 0))
+		return;
+	if (method >= CTBotApiMethodCount)
+		method = CTBotApiOther;
+
+	sampleHeap();
+	uint32_t used = m_callStartHeap - m_callMinHeap;
+	if (used > m_data.heapPeak[method])
+		m_data.heapPeak[method] = used;
+
+	if ((m_heapBudget > 0) && (used > m_heapBudget)) {
+		m_data.heapBudgetExceeded++;
+		serialLog(FSTR("--->heap budget exceeded: "), CTBOT_DEBUG_MEMORY);
+		serialLog(used, CTBOT_DEBUG_MEMORY);
+		serialLog(FSTR(" bytes\n"), CTBOT_DEBUG_MEMORY);
+	}
+}
+
+CTBotMetricsSnapshot CTBotMetrics::getSnapshot() const {
+	return m_data;
+}
+
+CTBotApiMethod CTBotMetrics::toApiMethod(const String& command) {
+	for (uint8_t i = 0; i < CTBotApiOther; i++) {
+		if (command == apiMethodNames[i])
+			return (CTBotApiMethod)i;
+	}
+	return CTBotApiOther;
+}
+
+String CTBotMetrics::toCommand(CTBotApiMethod method) {
+	if (method >= CTBotApiOther)
+		return("");
+	return(apiMethodNames[method]);
+}
+
+void CTBotMetrics::addSample(CTBotHistogram& histogram, uint32_t value, const uint32_t* bounds) {
+	uint8_t i = 0;
+	while ((i < CTBOT_HISTOGRAM_BUCKETS - 1) && (value > bounds[i]))
+		i++;
+	histogram.bucket[i]++;
+	histogram.count++;
+	histogram.sum += value;
+}
+
+void CTBotMetrics::printHistogram(Print& out, const char* name, const char* label, const CTBotHistogram& histogram, const uint32_t* bounds) const {
+	uint32_t cumulative = 0;
+	for (uint8_t i = 0; i < CTBOT_HISTOGRAM_BUCKETS; i++) {
+		cumulative += histogram.bucket[i];
+		out.print(name);
+		out.print(FSTR("_bucket{"));
+		if (label != NULL) {
+			out.print(label);
+			out.print(',');
+		}
+		out.print(FSTR("le=\""));
+		if (i < CTBOT_HISTOGRAM_BUCKETS - 1)
+			out.print(bounds[i]);
+		else
+			out.print(FSTR("+Inf"));
+		out.print(FSTR("\"} "));
+		out.println(cumulative);
+	}
+	out.print(name);
+	out.print(FSTR("_sum"));
+	if (label != NULL) {
+		out.print('{');
+		out.print(label);
+		out.print('}');
+	}
+	out.print(' ');
+	out.println(histogram.sum);
+	out.print(name);
+	out.print(FSTR("_count"));
+	if (label != NULL) {
+		out.print('{');
+		out.print(label);
+		out.print('}');
+	}
+	out.print(' ');
+	out.println(histogram.count);
+}
+
+void CTBotMetrics::printPrometheus(Print& out) const {
+	out.println(FSTR("# TYPE ctbot_requests_total counter"));
+	out.print(FSTR("ctbot_requests_total "));
+	out.println(m_data.requests);
+	out.println(FSTR("# TYPE ctbot_request_failures_total counter"));
+	out.print(FSTR("ctbot_request_failures_total "));
+	out.println(m_data.failures);
+	out.println(FSTR("# TYPE ctbot_request_timeouts_total counter"));
+	out.print(FSTR("ctbot_request_timeouts_total "));
+	out.println(m_data.timeouts);
+	out.println(FSTR("# TYPE ctbot_request_deadline_expired_total counter"));
+	out.print(FSTR("ctbot_request_deadline_expired_total "));
+	out.println(m_data.deadlineExpired);
+	out.println(FSTR("# TYPE ctbot_received_bytes_total counter"));
+	out.print(FSTR("ctbot_received_bytes_total "));
+	out.println(m_data.bytesIn);
+	out.println(FSTR("# TYPE ctbot_sent_bytes_total counter"));
+	out.print(FSTR("ctbot_sent_bytes_total "));
+	out.println(m_data.bytesOut);
+	out.println(FSTR("# TYPE ctbot_too_many_requests_total counter"));
+	out.print(FSTR("ctbot_too_many_requests_total "));
+	out.println(m_data.tooManyRequests);
+	out.println(FSTR("# TYPE ctbot_connect_fallbacks_total counter"));
+	out.print(FSTR("ctbot_connect_fallbacks_total "));
+	out.println(m_data.connectFallbacks);
+	out.println(FSTR("# TYPE ctbot_updates_received_total counter"));
+	out.print(FSTR("ctbot_updates_received_total "));
+	out.println(m_data.updatesReceived);
+	out.println(FSTR("# TYPE ctbot_free_heap_min_bytes gauge"));
+	out.print(FSTR("ctbot_free_heap_min_bytes "));
+	out.println(m_data.minFreeHeap);
+	out.println(FSTR("# TYPE ctbot_free_block_min_bytes gauge"));
+	out.print(FSTR("ctbot_free_block_min_bytes "));
+	out.println(m_data.minFreeBlock);
+	out.println(FSTR("# TYPE ctbot_heap_budget_exceeded_total counter"));
+	out.print(FSTR("ctbot_heap_budget_exceeded_total "));
+	out.println(m_data.heapBudgetExceeded);
+
+	String label;
+	out.println(FSTR("# TYPE ctbot_call_heap_peak_bytes gauge"));
+	for (uint8_t i = 0; i < CTBotApiMethodCount; i++) {
+		out.print(FSTR("ctbot_call_heap_peak_bytes{method=\""));
+		out.print(apiMethodNames[i]);
+		out.print(FSTR("\"} "));
+		out.println(m_data.heapPeak[i]);
+	}
+
+	out.println(FSTR("# TYPE ctbot_request_duration_ms histogram"));
+	for (uint8_t i = 0; i < CTBotApiMethodCount; i++) {
+		label = (String)FSTR("method=\"") + apiMethodNames[i] + (String)"\"";
+		printHistogram(out, "ctbot_request_duration_ms", label.c_str(), m_data.latency[i], latencyBounds);
+	}
+
+	out.println(FSTR("# TYPE ctbot_request_phase_duration_ms histogram"));
+	for (uint8_t i = 0; i < CTBotPhaseCount; i++) {
+		label = (String)FSTR("phase=\"") + phaseNames[i] + (String)"\"";
+		printHistogram(out, "ctbot_request_phase_duration_ms", label.c_str(), m_data.phase[i], latencyBounds);
+	}
+
+	out.println(FSTR("# TYPE ctbot_tls_handshake_duration_ms histogram"));
+	printHistogram(out, "ctbot_tls_handshake_duration_ms", NULL, m_data.handshake, latencyBounds);
+
+	out.println(FSTR("# TYPE ctbot_delivery_lag_min_ms gauge"));
+	out.print(FSTR("ctbot_delivery_lag_min_ms "));
+	out.println(m_data.deliveryLagMin);
+	out.println(FSTR("# TYPE ctbot_delivery_lag_max_ms gauge"));
+	out.print(FSTR("ctbot_delivery_lag_max_ms "));
+	out.println(m_data.deliveryLagMax);
+	out.println(FSTR("# TYPE ctbot_delivery_lag_ms histogram"));
+	printHistogram(out, "ctbot_delivery_lag_ms", NULL, m_data.deliveryLag, lagBounds);
+}
+
+CTBotHeapScope::CTBotHeapScope(CTBotMetrics& metrics, CTBotApiMethod method) : m_metrics(metrics), m_method(method) {
+	m_metrics.beginCall();
+}
+
+CTBotHeapScope::~CTBotHeapScope() {
+	m_metrics.endCall(m_method);
+}
@@ -0,0 +1,252 @@
+#pragma once
+#ifndef CTBOTMETRICS
+#define CTBOTMETRICS
+
+#include <Arduino.h>
+#include "CTBotDefines.h"
+
+// Telegram API methods tracked by the per method latency histograms
+enum CTBotApiMethod {
+	CTBotApiGetMe               = 0,
+	CTBotApiGetUpdates          = 1,
+	CTBotApiSendMessage         = 2,
+	CTBotApiEditMessageText     = 3,
+	CTBotApiAnswerCallbackQuery = 4,
+	CTBotApiOther               = 5,
+	CTBotApiMethodCount         = 6
+};
+
+// phases of a request sent to the Telegram server
+enum CTBotRequestPhase {
+	CTBotPhaseDNS        = 0, // name resolution
+	CTBotPhaseConnect    = 1, // TCP connection and TLS handshake
+	CTBotPhaseSend       = 2, // request write
+	CTBotPhaseFirstByte  = 3, // wait for the first response byte (time to first byte)
+	CTBotPhaseTransfer   = 4, // response body transfer
+	CTBotPhaseCount      = 5
+};
+
+// statistics of a single request sent to the Telegram server. All times are in milliseconds
+struct CTBotRequestStats {
+	uint32_t dnsTime;       // name resolution
+	uint32_t connectTime;   // TCP connection and TLS handshake: the Arduino clients don't expose the boundary
+	uint32_t handshakeTime; // TCP connection and TLS handshake of the successful attempt only
+	uint32_t sendTime;      // request write
+	uint32_t firstByteTime; // from the end of the request to the first response byte
+	uint32_t transferTime;  // from the first response byte to the end of the response
+	uint32_t bytesOut;      // bytes sent
+	uint32_t bytesIn;       // bytes received
+	uint32_t minFreeHeap;   // free heap low-water mark during the request, in bytes
+	uint32_t minFreeBlock;  // largest free heap block low-water mark during the request, in bytes
+	uint32_t serverTime;    // Telegram server time (HTTP "Date" header), in Unix time. Zero if not provided
+	uint16_t statusCode;    // HTTP status code, zero if no response was received
+	uint8_t  connectAttempts; // candidate addresses tried before connecting (1 -> the preferred one worked)
+	bool     resolved;      // true if a name resolution was made (false when using the fixed IP)
+	bool     timedOut;      // true if the connection was closed before receiving the whole response
+	bool     deadlineExpired; // true if the request was aborted because its deadline expired
+};
+
+// statistics of the last broadcast (CTBot::broadcastMessage()). All times are in milliseconds
+struct CTBotBroadcastStats {
+	uint32_t elapsed;         // whole broadcast duration, pauses for the flood limits included
+	uint32_t throttled;       // time spent waiting for the flood limits
+	uint16_t recipients;      // recipients of the broadcast
+	uint16_t delivered;       // recipients that got the message
+	uint16_t tooManyRequests; // recipients refused with "429 Too Many Requests"
+	uint16_t connections;     // connections used (one for every pipelined batch)
+	uint32_t bytesOut;        // bytes sent
+	uint32_t bytesIn;         // bytes received
+};
+
+// statistics of the outbound queue (CTBot::queueMessage(), CTBot::queueEditMessageText())
+struct CTBotOutboxStats {
+	uint32_t coalesced; // queued edits merged with an already queued edit of the same message
+	uint32_t dropped;   // calls dropped because the queue was full
+	uint8_t  queued;    // calls waiting in the queue
+};
+
+// statistics of the adaptive poll scheduler (non blocking CTBot::getNewMessage()). All times are in milliseconds
+struct CTBotPollStats {
+	uint32_t interval;          // current time between two polls
+	uint32_t polls;             // getUpdates requests sent
+	uint32_t updatePolls;       // polls that returned an update
+	uint32_t elapsed;           // time since the statistics start
+	uint32_t pollsPerHour;      // effective poll rate
+	uint32_t averageUpdateWait; // estimated average time an update waited on the Telegram server before being polled
+};
+
+// statistics of the low power polling (CTBot::setLowPowerMode()). All times are in milliseconds
+struct CTBotSleepStats {
+	uint32_t wakes;             // wake windows (poll and outbound queue, or a single request, with the radio awake)
+	uint32_t updates;           // updates fetched during the wake windows
+	uint32_t awakeTime;         // time with the radio awake
+	uint32_t sleepTime;         // time with the radio sleeping
+	uint32_t lastWakeTime;      // duration of the last wake window
+	uint32_t averageWakeTime;   // average duration of a wake window
+	uint32_t energy;            // estimated radio energy, in mJ (see CTBOT_POWER_AWAKE)
+	uint32_t averageWakeEnergy; // estimated radio energy of a wake window, in mJ
+	uint16_t dutyCycle;         // awake time, per mille of the total time
+};
+
+// statistics of the WiFi connections (CTBot::wifiConnect()). All times are in milliseconds
+struct CTBotWifiStats {
+	uint32_t connectTime;  // duration of the last connection attempt, from the call to the IP address
+	uint32_t connects;     // successful connections
+	uint32_t fastConnects; // successful connections made with the cached access point (no scan, no DHCP)
+	uint32_t fastFailures; // fast connections failed and repeated with a full scan
+	uint32_t failures;     // failed connections
+	uint32_t incidents;    // connection losses recovered by the connection manager
+	uint32_t lastDowntime; // duration of the last connection loss, from the disconnection to the IP address
+	uint32_t maxDowntime;  // longest connection loss
+	uint32_t totalDowntime;// sum of all the connection losses (average: totalDowntime / incidents)
+	uint32_t roams;        // switches to a better access point
+	int8_t   rssi;         // signal strength of the last connection, in dBm
+	uint8_t  channel;      // WiFi channel of the last connection
+	bool     fastPath;     // true if the last connection was made with the cached access point
+};
+
+// number of histogram buckets, the last one is the "+Inf" bucket
+#define CTBOT_HISTOGRAM_BUCKETS 8
+
+// histogram: every bucket counts the samples that are less or equal to its upper bound (non cumulative).
+// Upper bounds (in milliseconds) of the latency histograms: 50, 100, 250, 500, 1000, 2500, 5000, +Inf
+// Upper bounds (in milliseconds) of the delivery lag histogram: 1000, 2000, 5000, 10000, 30000, 60000, 300000, +Inf
+struct CTBotHistogram {
+	uint32_t bucket[CTBOT_HISTOGRAM_BUCKETS];
+	uint32_t count; // number of samples
+	uint32_t sum;   // sum of all the samples, in milliseconds
+};
+
+struct CTBotMetricsSnapshot {
+	uint32_t       requests;          // requests sent to the Telegram server
+	uint32_t       failures;          // requests failed (no connection, no response or Telegram error)
+	uint32_t       timeouts;          // requests without a complete response
+	uint32_t       deadlineExpired;   // requests aborted because their deadline expired
+	uint32_t       bytesIn;           // bytes received from the Telegram server
+	uint32_t       bytesOut;          // bytes sent to the Telegram server
+	uint32_t       tooManyRequests;   // Telegram "429 Too Many Requests" errors
+	uint32_t       connectFallbacks;  // requests that had to try more than one candidate address
+	uint32_t       updatesReceived;   // updates (messages/queries) received
+	uint32_t       minFreeHeap;       // free heap low-water mark, in bytes
+	uint32_t       minFreeBlock;      // largest free heap block low-water mark, in bytes (TLS needs big blocks)
+	uint32_t       heapBudgetExceeded;// calls whose sampled heap peak exceeded the budget (see CTBot::setHeapBudget())
+	uint32_t       heapPeak[CTBotApiMethodCount]; // max sampled heap peak of a single call (free heap drop from the call start
+	                                              // to its lowest sample), one value for every API method. Not an allocation count
+	uint32_t       deliveryLagMin;    // min delivery lag (message date -> getNewMessage), in milliseconds
+	uint32_t       deliveryLagMax;    // max delivery lag, in milliseconds (average: deliveryLag.sum / deliveryLag.count)
+	CTBotHistogram deliveryLag;       // delivery lag histogram
+	CTBotHistogram latency[CTBotApiMethodCount]; // request latency, one histogram for every API method
+	CTBotHistogram phase[CTBotPhaseCount];       // request latency, one histogram for every request phase
+	CTBotHistogram handshake;                    // TCP connection and TLS handshake of every new connection
+};
+
+class CTBotMetrics
+{
+public:
+	// default constructor
+	CTBotMetrics();
+
+	// clear all the counters and the histograms
+	void reset();
+
+	// account a request sent to the Telegram server
+	// params
+	//   method  : the API method used by the request
+	//   elapsed : the request duration, in milliseconds
+	//   success : false if the request didn't get a response (connection error or timeout)
+	//   stats   : the request statistics (bytes and phase timings) reported by the connection
+	void addRequest(CTBotApiMethod method, uint32_t elapsed, bool success, const CTBotRequestStats& stats);
+
+	// account an error returned by the Telegram server ("ok": false)
+	// params
+	//   errorCode: the Telegram "error_code" field (429 -> too many requests)
+	//              zero means no response, already accounted by addRequest()
+	void addAPIError(int errorCode);
+
+	// account a received update and sample the free heap
+	void addUpdate();
+
+	// account the delivery lag of a message: how long after the Telegram server timestamp
+	// the message was returned to the application
+	// params
+	//   lag: the delivery lag, in milliseconds
+	void addDeliveryLag(uint32_t lag);
+
+	// sample the free heap and the largest free block, updating the low-water marks
+	void sampleHeap();
+
+	// set the max heap a library call can use. A call that uses more is accounted in heapBudgetExceeded
+	// params
+	//   budget: the heap budget, in bytes. Zero disables the check
+	void setHeapBudget(uint32_t budget);
+
+	// start measuring the heap used by a library call. Nested calls are accounted by the outer one
+	void beginCall();
+
+	// stop measuring the heap used by a library call, updating the heap peak of the API method
+	// and checking the heap budget
+	// params
+	//   method: the API method used by the call
+	void endCall(CTBotApiMethod method);
+
+	// get a copy of all the collected metrics
+	// returns
+	//   the metrics snapshot
+	CTBotMetricsSnapshot getSnapshot() const;
+
+	// print all the collected metrics using the Prometheus text exposition format
+	// params
+	//   out: where to print the metrics (Serial, a WiFiClient...)
+	void printPrometheus(Print& out) const;
+
+	// convert a Telegram command to the tracked API method
+	// params
+	//   command: the command, i.e. getMe
+	// returns
+	//   the API method (CTBotApiOther if not tracked)
+	static CTBotApiMethod toApiMethod(const String& command);
+
+	// convert a tracked API method to the Telegram command
+	// params
+	//   method: the API method
+	// returns
+	//   the command, i.e. getMe (empty string for CTBotApiOther)
+	static String toCommand(CTBotApiMethod method);
+
+private:
+	CTBotMetricsSnapshot m_data;
+	uint32_t             m_heapBudget;
+	uint8_t              m_callDepth;
+	uint32_t             m_callStartHeap;
+	uint32_t             m_callMinHeap;
+
+	// update the low-water marks with a sample
+	void sampleHeap(uint32_t freeHeap, uint32_t freeBlock);
+
+	// add a sample to a histogram
+	// params
+	//   histogram: the histogram to update
+	//   value    : the sample value, in milliseconds
+	//   bounds   : the buckets upper bound (CTBOT_HISTOGRAM_BUCKETS - 1 values, the last bucket is +Inf)
+	static void addSample(CTBotHistogram& histogram, uint32_t value, const uint32_t* bounds);
+
+	void printHistogram(Print& out, const char* name, const char* label, const CTBotHistogram& histogram, const uint32_t* bounds) const;
+};
+
+// measure the heap peak of a library call: the measure starts when the object is created
+// and stops when the object is destroyed (the call returns). The free heap is sampled at the call
+// boundaries and at the sample points of the request (TLS buffers, response, JSON document), so an
+// allocation freed between two samples is not seen. The allocator is not hooked: there is no
+// allocation count and no bytes allocated figure
+class CTBotHeapScope
+{
+public:
+	CTBotHeapScope(CTBotMetrics& metrics, CTBotApiMethod method);
+	~CTBotHeapScope();
+
+private:
+	CTBotMetrics&  m_metrics;
+	CTBotApiMethod m_method;
+};
+
+#endif
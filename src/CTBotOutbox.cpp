@@ -0,0 +1,131 @@
+#include "CTBotOutbox.h"
+#include "Utilities.h"
+
+CTBotOutbox::CTBotOutbox() {
+	resetStats();
+	clear();
+}
+
+void CTBotOutbox::clear(void) {
+	for (uint8_t i = 0; i < CTBOT_OUTBOX_SIZE; i++) {
+		m_used[i]       = false;
+		m_parameters[i] = "";
+	}
+	m_nextSequence = 0;
+}
+
+bool CTBotOutbox::isBefore(uint8_t slot, uint8_t other) {
+	if (m_priority[slot] != m_priority[other])
+		return(m_priority[slot] < m_priority[other]);
+	return((int32_t)(m_sequence[other] - m_sequence[slot]) > 0);
+}
+
+bool CTBotOutbox::add(CTBotApiMethod method, CTBotPriority priority, int64_t chatID, int32_t messageID, const String& parameters) {
+	int8_t freeSlot = -1;
+
+	for (uint8_t i = 0; i < CTBOT_OUTBOX_SIZE; i++) {
+		if (!m_used[i]) {
+			if (freeSlot < 0)
+				freeSlot = i;
+			continue;
+		}
+		// only the latest text of an edited message matters: merge it with the queued edit,
+		// keeping its place in the queue
+		if ((CTBotApiEditMessageText == method) && (CTBotApiEditMessageText == m_method[i]) &&
+			(m_chatID[i] == chatID) && (m_messageID[i] == messageID)) {
+			m_parameters[i] = parameters;
+			if (priority < m_priority[i])
+				m_priority[i] = priority;
+			m_coalesced++;
+			return true;
+		}
+	}
+
+	if (freeSlot < 0) {
+		// queue full: drop the call that would be sent last, if it has a lower priority
+		uint8_t last = 0;
+		for (uint8_t i = 1; i < CTBOT_OUTBOX_SIZE; i++) {
+			if (isBefore(last, i))
+				last = i;
+		}
+		m_dropped++;
+		if (m_priority[last] <= priority) {
+			serialLog(FSTR("CTBotOutbox: queue full, call dropped\n"), CTBOT_DEBUG_CONNECTION);
+			return false;
+		}
+		serialLog(FSTR("CTBotOutbox: queue full, lower priority call dropped\n"), CTBOT_DEBUG_CONNECTION);
+		freeSlot = last;
+	}
+
+	m_used[freeSlot]       = true;
+	m_method[freeSlot]     = method;
+	m_priority[freeSlot]   = priority;
+	m_chatID[freeSlot]     = chatID;
+	m_messageID[freeSlot]  = messageID;
+	m_parameters[freeSlot] = parameters;
+	m_sequence[freeSlot]   = m_nextSequence++;
+	return true;
+}
+
+uint8_t CTBotOutbox::select(uint8_t* slots, uint8_t maxCount) {
+	bool selected[CTBOT_OUTBOX_SIZE] = { false };
+	uint8_t count = 0;
+
+	while (count < maxCount) {
+		int8_t next = -1;
+		for (uint8_t i = 0; i < CTBOT_OUTBOX_SIZE; i++) {
+			if (!m_used[i] || selected[i])
+				continue;
+			// one call for every chat
+			bool sameChat = false;
+			for (uint8_t j = 0; (j < count) && !sameChat; j++)
+				sameChat = (m_chatID[slots[j]] == m_chatID[i]);
+			if (sameChat)
+				continue;
+			if ((next < 0) || isBefore(i, next))
+				next = i;
+		}
+		if (next < 0)
+			break;
+		selected[next] = true;
+		slots[count++] = next;
+	}
+	return count;
+}
+
+void CTBotOutbox::remove(uint8_t slot) {
+	if (slot >= CTBOT_OUTBOX_SIZE)
+		return;
+	m_used[slot]       = false;
+	m_parameters[slot] = ""; // free the memory
+}
+
+uint8_t CTBotOutbox::getCount(void) {
+	uint8_t count = 0;
+	for (uint8_t i = 0; i < CTBOT_OUTBOX_SIZE; i++) {
+		if (m_used[i])
+			count++;
+	}
+	return count;
+}
+
+uint32_t CTBotOutbox::getCoalescedCount(void) {
+	return m_coalesced;
+}
+
+uint32_t CTBotOutbox::getDroppedCount(void) {
+	return m_dropped;
+}
+
+void CTBotOutbox::resetStats(void) {
+	m_coalesced = 0;
+	m_dropped   = 0;
+}
+
+CTBotApiMethod CTBotOutbox::getMethod(uint8_t slot) {
+	return m_method[slot];
+}
+
+const String& CTBotOutbox::getParameters(uint8_t slot) {
+	return m_parameters[slot];
+}
@@ -0,0 +1,83 @@
+#pragma once
+#ifndef CTBOT_OUTBOX
+#define CTBOT_OUTBOX
+
+#include <Arduino.h>
+#include "CTBotDataStructures.h"
+#include "CTBotMetrics.h"
+#include "CTBotDefines.h"
+
+// outbound queue of the calls waiting to be sent to the Telegram server. Higher priority calls are
+// sent first, calls with the same priority in the same order they are queued. Queued edits of the
+// same message are merged: only the latest text is sent
+class CTBotOutbox
+{
+public:
+	CTBotOutbox();
+
+	// remove all the queued calls
+	void clear(void);
+
+	// queue a call
+	// params
+	//   method    : the Telegram API method
+	//   priority  : the call priority
+	//   chatID    : the recipient chat ID
+	//   messageID : the edited message ID (editMessageText only)
+	//   parameters: the query string
+	// returns
+	//   true if the call was queued. When the queue is full, the newest lowest priority call
+	//   is dropped to make room for a higher priority one
+	bool add(CTBotApiMethod method, CTBotPriority priority, int64_t chatID, int32_t messageID, const String& parameters);
+
+	// select the next calls to send: the highest priority ones, no more than one for every chat
+	// (Telegram rate limits the messages sent to the same chat)
+	// params
+	//   slots   : the array that will contain the selected calls
+	//   maxCount: the max number of calls to select
+	// returns
+	//   the number of selected calls
+	uint8_t select(uint8_t* slots, uint8_t maxCount);
+
+	// remove a call from the queue (i.e. because it was sent)
+	// params
+	//   slot: the call returned by select()
+	void remove(uint8_t slot);
+
+	// get how many calls are waiting in the queue
+	// returns
+	//   the number of queued calls
+	uint8_t getCount(void);
+
+	// get how many edits were merged with an already queued edit of the same message
+	uint32_t getCoalescedCount(void);
+
+	// get how many calls were dropped because the queue was full
+	uint32_t getDroppedCount(void);
+
+	// clear the coalesced and dropped counters
+	void resetStats(void);
+
+	// get the API method of a queued call
+	CTBotApiMethod getMethod(uint8_t slot);
+
+	// get the query string of a queued call
+	const String& getParameters(uint8_t slot);
+
+private:
+	bool           m_used[CTBOT_OUTBOX_SIZE];
+	CTBotApiMethod m_method[CTBOT_OUTBOX_SIZE];
+	CTBotPriority  m_priority[CTBOT_OUTBOX_SIZE];
+	int64_t        m_chatID[CTBOT_OUTBOX_SIZE];
+	int32_t        m_messageID[CTBOT_OUTBOX_SIZE];
+	String         m_parameters[CTBOT_OUTBOX_SIZE];
+	uint32_t       m_sequence[CTBOT_OUTBOX_SIZE]; // queue order
+	uint32_t       m_nextSequence;
+	uint32_t       m_coalesced;
+	uint32_t       m_dropped;
+
+	// check if a queued call must be sent before another one
+	bool isBefore(uint8_t slot, uint8_t other);
+};
+
+#endif
@@ -0,0 +1,61 @@
+#include "CTBotPollScheduler.h"
+
+CTBotPollScheduler::CTBotPollScheduler() {
+	m_minInterval = CTBOT_POLL_INTERVAL_MIN;
+	m_maxInterval = CTBOT_POLL_INTERVAL_MAX;
+	m_interval    = m_minInterval;
+	m_lastPoll    = millis();
+	resetStats();
+}
+
+void CTBotPollScheduler::setIntervals(uint32_t minInterval, uint32_t maxInterval) {
+	// a zero interval could never be doubled: the idle bot would poll on every call
+	if (0 == minInterval)
+		minInterval = 1;
+	if (maxInterval < minInterval)
+		maxInterval = minInterval;
+	m_minInterval = minInterval;
+	m_maxInterval = maxInterval;
+	m_interval    = minInterval;
+}
+
+bool CTBotPollScheduler::isDue(void) {
+	// unsigned subtraction: safe across the millis() overflow
+	return((millis() - m_lastPoll) >= m_interval);
+}
+
+void CTBotPollScheduler::pollNow(void) {
+	m_lastPoll = millis() - m_interval;
+}
+
+void CTBotPollScheduler::addPoll(bool gotUpdate, uint32_t startTime) {
+	m_polls++;
+	if (gotUpdate) {
+		// the update arrived somewhere between the previous poll and this one
+		m_updatePolls++;
+		m_updateGapSum += startTime - m_lastPoll;
+		m_interval = m_minInterval;
+	}
+	else if (m_interval < m_maxInterval)
+		m_interval = (m_interval > m_maxInterval / 2) ? m_maxInterval : m_interval * 2;
+	m_lastPoll = millis();
+}
+
+CTBotPollStats CTBotPollScheduler::getStats(void) {
+	CTBotPollStats stats;
+	stats.interval    = m_interval;
+	stats.polls       = m_polls;
+	stats.updatePolls = m_updatePolls;
+	stats.elapsed     = millis() - m_statsStart;
+	stats.pollsPerHour = (0 == stats.elapsed) ? 0 : (uint32_t)((uint64_t)m_polls * 3600000ULL / stats.elapsed);
+	// uniform arrivals: on average an update waits half of the gap before being polled
+	stats.averageUpdateWait = (0 == m_updatePolls) ? 0 : m_updateGapSum / m_updatePolls / 2;
+	return(stats);
+}
+
+void CTBotPollScheduler::resetStats(void) {
+	m_statsStart   = millis();
+	m_polls        = 0;
+	m_updatePolls  = 0;
+	m_updateGapSum = 0;
+}
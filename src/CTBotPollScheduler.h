@@ -0,0 +1,56 @@
+#pragma once
+#ifndef CTBOT_POLL_SCHEDULER
+#define CTBOT_POLL_SCHEDULER
+
+#include <Arduino.h>
+#include "CTBotMetrics.h"
+#include "CTBotDefines.h"
+
+// adaptive getUpdates scheduler of the non blocking getNewMessage(): after an update the Telegram
+// server is polled every minInterval milliseconds, then every empty poll doubles the interval
+// up to maxInterval. A busy chat gets a low latency, an idle bot sends few requests
+class CTBotPollScheduler
+{
+public:
+	CTBotPollScheduler();
+
+	// set the poll interval bounds. The same value for both gives a fixed interval
+	// params
+	//   minInterval: the interval after an update, in milliseconds (at least 1)
+	//   maxInterval: the max interval when idle, in milliseconds
+	void setIntervals(uint32_t minInterval, uint32_t maxInterval);
+
+	// check if the next poll is due
+	// returns
+	//   true if the current interval has passed since the last poll
+	bool isDue(void);
+
+	// make the next poll due immediately
+	void pollNow(void);
+
+	// account a poll and compute the next interval
+	// params
+	//   gotUpdate: true if the poll returned an update
+	//   startTime: millis() when the poll request started
+	void addPoll(bool gotUpdate, uint32_t startTime);
+
+	// get the scheduler statistics
+	// returns
+	//   the poll statistics since the last resetStats()
+	CTBotPollStats getStats(void);
+
+	// clear the statistics
+	void resetStats(void);
+
+private:
+	uint32_t m_minInterval;
+	uint32_t m_maxInterval;
+	uint32_t m_interval;      // current interval
+	uint32_t m_lastPoll;      // millis() at the end of the last poll
+	uint32_t m_statsStart;    // millis() of the last resetStats()
+	uint32_t m_polls;
+	uint32_t m_updatePolls;
+	uint32_t m_updateGapSum;  // sum of the gaps between the previous poll and the polls that returned an update
+};
+
+#endif
@@ -0,0 +1,74 @@
+#pragma once
+#ifndef CTBOT_SPSC_QUEUE
+#define CTBOT_SPSC_QUEUE
+
+#include <stdint.h>
+#include <atomic>
+
+// lock free single producer / single consumer ring buffer: one task (or thread) pushes, another one
+// pops, no mutex. The producer publishes an item with a release store of the tail, the consumer
+// frees a slot with a release store of the head. One slot is kept empty to tell full from empty
+template <typename T, uint16_t N>
+class CTBotSPSCQueue
+{
+public:
+	CTBotSPSCQueue() : m_head(0), m_tail(0) {}
+
+	// add an item (producer only)
+	// params
+	//   item: the item to add
+	// returns
+	//   false if the queue is full
+	bool push(const T& item) {
+		uint16_t tail = m_tail.load(std::memory_order_relaxed);
+		uint16_t next = advance(tail);
+		if (next == m_head.load(std::memory_order_acquire))
+			return false;
+		m_items[tail] = item;
+		m_tail.store(next, std::memory_order_release);
+		return true;
+	}
+
+	// remove the oldest item (consumer only)
+	// params
+	//   item: will contain the removed item
+	// returns
+	//   false if the queue is empty
+	bool pop(T& item) {
+		uint16_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tail.load(std::memory_order_acquire))
+			return false;
+		item = m_items[head];
+		m_items[head] = T(); // free the heap used by the item (i.e. Strings) in the consumer
+		m_head.store(advance(head), std::memory_order_release);
+		return true;
+	}
+
+	// check if the queue is full (exact for the producer)
+	bool isFull(void) const {
+		return(advance(m_tail.load(std::memory_order_relaxed)) == m_head.load(std::memory_order_acquire));
+	}
+
+	// check if the queue is empty (exact for the consumer)
+	bool isEmpty(void) const {
+		return(m_head.load(std::memory_order_relaxed) == m_tail.load(std::memory_order_acquire));
+	}
+
+	// get the number of queued items (a snapshot when called by the other side)
+	uint16_t getCount(void) const {
+		uint16_t head = m_head.load(std::memory_order_acquire);
+		uint16_t tail = m_tail.load(std::memory_order_acquire);
+		return((tail >= head) ? tail - head : N + 1 - head + tail);
+	}
+
+private:
+	T                     m_items[N + 1];
+	std::atomic<uint16_t> m_head; // next item to pop, written by the consumer only
+	std::atomic<uint16_t> m_tail; // next free slot, written by the producer only
+
+	static uint16_t advance(uint16_t index) {
+		return((index + 1 == N + 1) ? 0 : index + 1);
+	}
+};
+
+#endif
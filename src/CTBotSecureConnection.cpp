@@ -1,13 +1,83 @@
+#if defined(ARDUINO_ARCH_ESP8266) // ESP8266
+#include <ESP8266WiFi.h>
+#elif defined(ARDUINO_ARCH_ESP32) // ESP32
+#include <WiFi.h>
+#endif
 #include <WiFiClientSecure.h>
 #include "CTBotSecureConnection.h"
 #include "Utilities.h"
+#include "CTBotTrace.h"
 
 #define TELEGRAM_URL  FSTR("api.telegram.org") 
 #define TELEGRAM_IP   FSTR("149.154.167.220") // "149.154.167.198" <-- Old IP
 #define TELEGRAM_PORT 443
 
 CTBotSecureConnection::CTBotSecureConnection() {
-	m_useDNS = true;
+	m_useDNS         = true;
+	m_requestStart   = 0;
+	m_requestTimeout = CTBOT_REQUEST_TIMEOUT;
+#if defined(ARDUINO_ARCH_ESP8266)
+	m_serverKey      = NULL;
+	m_cipherCount    = 0;
+	m_mflnProbed     = false;
+	m_mflnSupported  = false;
+#endif
+	m_bodyLimit      = 0;
+	m_sink           = NULL;
+	m_skip           = 0;
+	m_downloaded     = 0;
+	m_downloadTotal  = 0;
+	m_progress       = NULL;
+	memset(&m_lastRequestStats, 0, sizeof(m_lastRequestStats));
+	m_endpoints.addFallbackIP(TELEGRAM_IP);
+}
+
+CTBotSecureConnection::~CTBotSecureConnection() {
+#if defined(ARDUINO_ARCH_ESP8266)
+	if (m_serverKey != NULL)
+		delete m_serverKey;
+#endif
+}
+
+bool CTBotSecureConnection::setCipherSuites(const uint16_t* suites, uint8_t count) {
+#if defined(ARDUINO_ARCH_ESP8266)
+	if (count > CTBOT_MAX_CIPHER_SUITES)
+		return false;
+	for (uint8_t i = 0; i < count; i++)
+		m_ciphers[i] = suites[i];
+	m_cipherCount = count;
+	m_session = BearSSL::Session(); // a resumed session would keep the old cipher suite
+	return true;
+#else
+	(void)suites;
+	(void)count;
+	serialLog(FSTR("setCipherSuites is supported only by ESP8266.\n"), CTBOT_DEBUG_CONNECTION);
+	return false;
+#endif
+}
+
+bool CTBotSecureConnection::setServerKeyPin(const char* pin) {
+#if defined(ARDUINO_ARCH_ESP8266)
+	if (m_serverKey != NULL) {
+		delete m_serverKey;
+		m_serverKey = NULL;
+	}
+	m_session = BearSSL::Session(); // the trust of the resumed session was verified without the pin
+	if ((NULL == pin) || (0 == pin[0]))
+		return true;
+	m_serverKey = new BearSSL::PublicKey(pin);
+	if ((NULL == m_serverKey) || (!m_serverKey->isRSA() && !m_serverKey->isEC())) {
+		serialLog(FSTR("setServerKeyPin: invalid public key\n"), CTBOT_DEBUG_CONNECTION);
+		if (m_serverKey != NULL)
+			delete m_serverKey;
+		m_serverKey = NULL;
+		return false;
+	}
+	return true;
+#else
+	m_certPin = (NULL == pin) ? "" : pin;
+	return true;
+#endif
 }
 
 bool CTBotSecureConnection::useDNS(bool value) {
@@ -41,138 +111,681 @@ void CTBotSecureConnection::setStatusPin(int8_t pin) {
 	m_statusPin.setPin(pin);
 }
 
-String CTBotSecureConnection::send(const String& message) {
-#if defined(ARDUINO_ARCH_ESP8266) && CTBOT_USE_FINGERPRINT == 0 // ESP8266 no HTTPS verification
+const CTBotRequestStats& CTBotSecureConnection::getLastRequestStats() const {
+	return m_lastRequestStats;
+}
+
+String CTBotSecureConnection::send(const String& path, uint32_t timeout, bool discardBody) {
+	String response;
+	sendBatch(&path, &response, 1, timeout, discardBody);
+	return(response);
+}
+
+uint8_t CTBotSecureConnection::sendBatch(const String* paths, String* responses, uint8_t count, uint32_t timeout, bool discardBody,
+	const String& pathSuffix) {
+	for (uint8_t i = 0; i < count; i++)
+		responses[i] = "";
+	m_bodyLimit = discardBody ? CTBOT_RESPONSE_PREFIX_SIZE : 0;
+	beginRequest(timeout);
+
+#if defined(ARDUINO_ARCH_ESP8266)
+	BearSSL::WiFiClientSecure telegramServer;
+#else
 	WiFiClientSecure telegramServer;
-	telegramServer.setInsecure();
-	serialLog(FSTR("ESP8266 no https verification"), CTBOT_DEBUG_CONNECTION);
-#elif defined(ARDUINO_ARCH_ESP8266) && CTBOT_USE_FINGERPRINT == 1 // ESP8266 with HTTPS verification
+#endif
+	if (!openConnection(telegramServer))
+		return 0;
+
+	m_statusPin.toggle();
+
+	// send the HTTP requests back-to-back (pipelining): the connection is kept alive
+	// up to the last request, that asks the server to close it. The requests are written one
+	// at a time, so only one of them is in memory
+	uint32_t phaseStart = millis();
+	for (uint8_t i = 0; i < count; i++) {
+		String request = (String)FSTR("GET ") + paths[i] + pathSuffix + (String)FSTR(" HTTP/1.1\r\nHost: ") + (String)TELEGRAM_URL + (String)FSTR("\r\n");
+		if (i + 1 == count)
+			request += FSTR("Connection: close\r\n");
+		request += FSTR("\r\n");
+		m_lastRequestStats.bytesOut += telegramServer.print(request);
+	}
+	m_lastRequestStats.sendTime = millis() - phaseStart;
+	traceEvent(CTBotTraceRequestSent, m_lastRequestStats.bytesOut);
+
+	m_statusPin.toggle();
+
+	serialLog(FSTR("--->sendCommand  : Free heap memory: "), CTBOT_DEBUG_MEMORY);
+	serialLog(ESP.getFreeHeap(), CTBOT_DEBUG_MEMORY);
+
+	return(readResponses(telegramServer, responses, count));
+}
+
+String CTBotSecureConnection::upload(const String& path, const String& field, const String& fileName, Stream& data, uint32_t size, uint32_t timeout) {
+	String response;
+	bool chunked = (0 == size);
+
+	m_bodyLimit = 0;
+	beginRequest(timeout);
+
+#if defined(ARDUINO_ARCH_ESP8266)
 	BearSSL::WiFiClientSecure telegramServer;
-	telegramServer.setFingerprint(m_fingerprint);
-	serialLog(FSTR("ESP8266 with https verification"), CTBOT_DEBUG_CONNECTION);
-#elif defined(ARDUINO_ARCH_ESP32) // ESP32
+#else
 	WiFiClientSecure telegramServer;
+#endif
+	if (!openConnection(telegramServer))
+		return response;
+
+	m_statusPin.toggle();
+
+	// only the multipart headers are built in memory, the file is streamed
+	const String boundary = FSTR("----CTBotFormBoundary7MA4YWxkTrZu0gW");
+	String preamble = (String)FSTR("--") + boundary + (String)FSTR("\r\nContent-Disposition: form-data; name=\"") + field +
+		(String)FSTR("\"; filename=\"") + fileName + (String)FSTR("\"\r\nContent-Type: application/octet-stream\r\n\r\n");
+	String epilogue = (String)FSTR("\r\n--") + boundary + (String)FSTR("--\r\n");
+
+	String request = (String)FSTR("POST ") + path + (String)FSTR(" HTTP/1.1\r\nHost: ") + (String)TELEGRAM_URL +
+		(String)FSTR("\r\nContent-Type: multipart/form-data; boundary=") + boundary + (String)FSTR("\r\n");
+	if (chunked)
+		request += FSTR("Transfer-Encoding: chunked\r\n");
+	else
+		request += (String)FSTR("Content-Length: ") + (String)(preamble.length() + size + epilogue.length()) + (String)FSTR("\r\n");
+	request += FSTR("Connection: close\r\n\r\n");
+
+	uint32_t phaseStart = millis();
+	bool sent = writeBody(telegramServer, (const uint8_t*)request.c_str(), request.length(), false);
+	request = "";
+	sent = sent && writeBody(telegramServer, (const uint8_t*)preamble.c_str(), preamble.length(), chunked);
+
+	uint8_t buffer[CTBOT_UPLOAD_BUFFER_SIZE];
+	uint32_t left = size;
+	while (sent && (chunked ? (data.available() > 0) : (left > 0))) {
+		size_t length = CTBOT_UPLOAD_BUFFER_SIZE;
+		if (chunked && ((size_t)data.available() < length))
+			length = data.available();
+		else if (!chunked && (left < length))
+			length = left;
+		length = data.readBytes(buffer, length);
+		if (0 == length) {
+			// the stream ended before the declared size: the request can't be completed
+			sent = chunked;
+			break;
+		}
+		sent = writeBody(telegramServer, buffer, length, chunked);
+		if (!chunked)
+			left -= length;
+	}
+
+	sent = sent && writeBody(telegramServer, (const uint8_t*)epilogue.c_str(), epilogue.length(), chunked);
+	// last chunk
+	if (sent && chunked)
+		sent = writeBody(telegramServer, (const uint8_t*)"0\r\n\r\n", 5, false);
+	m_lastRequestStats.sendTime = millis() - phaseStart;
+	traceEvent(CTBotTraceRequestSent, m_lastRequestStats.bytesOut);
+
+	m_statusPin.toggle();
+
+	if (!sent) {
+		serialLog(FSTR("\nUnable to send the file to Telegram server\n"), CTBOT_DEBUG_CONNECTION);
+		telegramServer.stop();
+		return response;
+	}
+
+	readResponses(telegramServer, &response, 1);
+	return(response);
+}
+
+void CTBotSecureConnection::beginRequest(uint32_t timeout) {
+	memset(&m_lastRequestStats, 0, sizeof(m_lastRequestStats));
+	m_requestStart   = millis();
+	m_requestTimeout = (0 == timeout) ? CTBOT_REQUEST_TIMEOUT : timeout;
+}
+
+bool CTBotSecureConnection::writeBody(WiFiClient& client, const uint8_t* data, size_t length, bool chunked) {
+	uint32_t timeLeft = getTimeLeft(CTBOT_CONNECTION_TIMEOUT);
+	if (0 == timeLeft)
+		return false;
+	client.setTimeout(timeLeft);
+
+	if (chunked) {
+		// "<hex size>\r\n<data>\r\n"
+		char header[12];
+		snprintf(header, sizeof(header), "%X\r\n", (unsigned int)length);
+		size_t headerLength = strlen(header);
+		if (client.write((const uint8_t*)header, headerLength) != headerLength)
+			return false;
+		m_lastRequestStats.bytesOut += headerLength;
+	}
+	if (client.write(data, length) != length)
+		return false;
+	m_lastRequestStats.bytesOut += length;
+	if (chunked) {
+		if (client.write((const uint8_t*)"\r\n", 2) != 2)
+			return false;
+		m_lastRequestStats.bytesOut += 2;
+	}
+	return true;
+}
+
+bool CTBotSecureConnection::openConnection(WiFiClientSecure& client) {
+#if defined(ARDUINO_ARCH_ESP8266) // ESP8266
+	if (m_serverKey != NULL) {
+		// pinned public key: no certificate parsing at all
+		client.setKnownKey(m_serverKey);
+		serialLog(FSTR("ESP8266 with public key pinning"), CTBOT_DEBUG_CONNECTION);
+	}
+#if CTBOT_USE_FINGERPRINT == 0 // ESP8266 no HTTPS verification
+	else {
+		client.setInsecure();
+		serialLog(FSTR("ESP8266 no https verification"), CTBOT_DEBUG_CONNECTION);
+	}
+#else // ESP8266 with HTTPS verification
+	else {
+		client.setFingerprint(m_fingerprint);
+		serialLog(FSTR("ESP8266 with https verification"), CTBOT_DEBUG_CONNECTION);
+	}
+#endif
+	if (m_cipherCount > 0)
+		client.setCiphers(m_ciphers, m_cipherCount);
+	// resume the previous TLS session (if any): the abbreviated handshake skips the key exchange
+	// and the server validation
+	client.setSession(&m_session);
+#elif defined(ARDUINO_ARCH_ESP32) // ESP32
+	if (m_certPin.length() != 0) {
+		// pinned certificate, checked after the handshake instead of the certificate chain
+		client.setInsecure();
+		serialLog(FSTR("ESP32 with certificate pinning"), CTBOT_DEBUG_CONNECTION);
+	}
 #if CTBOT_USE_FINGERPRINT == 0
-	telegramServer.setInsecure();
-	serialLog(FSTR("ESP32 no https verification"), CTBOT_DEBUG_CONNECTION);
+	else {
+		client.setInsecure();
+		serialLog(FSTR("ESP32 no https verification"), CTBOT_DEBUG_CONNECTION);
+	}
 #else
-	telegramServer.setCACert(m_CAcert);
-	serialLog(FSTR("ESP32 with https verification"), CTBOT_DEBUG_CONNECTION);
+	else {
+		client.setCACert(m_CAcert);
+		serialLog(FSTR("ESP32 with https verification"), CTBOT_DEBUG_CONNECTION);
+	}
 #endif
 #endif
 
+	uint32_t phaseStart = millis();
+
+	// resolve the Telegram server name only when the cached address is missing or expired.
+	// The lookup gets the time left before the deadline: without time left the fallback IPs are used
+	uint32_t lookupTime = getTimeLeft(CTBOT_CONNECTION_TIMEOUT);
+	if (m_useDNS && (lookupTime > 0) && m_endpoints.needsResolution()) {
+		traceEvent(CTBotTraceDNSStart);
+		bool resolved = m_endpoints.resolve(TELEGRAM_URL, lookupTime);
+		traceEvent(CTBotTraceDNSEnd, resolved);
+		m_lastRequestStats.dnsTime = millis() - phaseStart;
+		m_lastRequestStats.resolved = true;
+		phaseStart = millis();
+	}
+
+	// try the candidate addresses, starting from the one that worked last time. The Arduino secure
+	// clients can't connect in parallel, so the attempts are staggered: every candidate but the last
+	// one gets a short timeout and a slow address is abandoned in favour of the next one
+	traceEvent(CTBotTraceConnectStart);
+	uint8_t candidates[CTBOT_MAX_ENDPOINTS];
+	uint8_t candidatesCount = m_endpoints.getCandidates(candidates, m_useDNS);
+	bool connected = false;
+	for (uint8_t i = 0; (i < candidatesCount) && !connected; i++) {
+		uint32_t timeLeft = getTimeLeft((i + 1 < candidatesCount) ? CTBOT_CONNECTION_STAGGER : CTBOT_CONNECTION_TIMEOUT);
+		if (0 == timeLeft)
+			break;
+		client.setTimeout(timeLeft);
 #if defined(ARDUINO_ARCH_ESP8266) // only for ESP8266 reduce drastically the heap usage (~15K more)
-	telegramServer.setBufferSizes(CTBOT_ESP8266_TCP_BUFFER_SIZE, CTBOT_ESP8266_TCP_BUFFER_SIZE);
+		setBufferSizes(client, m_endpoints.getAddress(candidates[i]));
 #endif
+		m_lastRequestStats.connectAttempts++;
+		uint32_t attemptStart = millis();
+		connected = connectTo(client, m_endpoints.getAddress(candidates[i]));
+		if (connected) {
+			m_lastRequestStats.handshakeTime = millis() - attemptStart;
+			m_endpoints.reportSuccess(candidates[i]);
+		}
+		else {
+			client.stop();
+			m_endpoints.reportFailure(candidates[i]);
+		}
+	}
+	if (!connected) {
+		serialLog(FSTR("\nUnable to connect to Telegram server\n"), CTBOT_DEBUG_CONNECTION);
+#if defined(ARDUINO_ARCH_ESP8266)
+		// maybe the server stopped honouring small records: probe it again with the next request
+		// (not with the next candidate, every probe is one more blocking TLS hello)
+		if (m_mflnSupported)
+			m_mflnProbed = false;
+#endif
+		m_lastRequestStats.connectTime = millis() - phaseStart;
+		traceEvent(CTBotTraceConnectEnd, 0);
+		return false;
+	}
+	m_lastRequestStats.connectTime = millis() - phaseStart;
+	traceEvent(CTBotTraceConnectEnd, 1);
+	traceHeap();
+	sampleHeap(); // TLS buffers allocated
 
-	telegramServer.setTimeout(CTBOT_CONNECTION_TIMEOUT);
+	// the request write can't go beyond the deadline
+	uint32_t timeLeft = getTimeLeft(CTBOT_CONNECTION_TIMEOUT);
+	if (0 == timeLeft) {
+		client.stop();
+		return false;
+	}
+	client.setTimeout(timeLeft);
+	return true;
+}
 
-	// check for using symbolic URLs
-	if (m_useDNS) {
-		// try to connect with URL
-		if (!telegramServer.connect(TELEGRAM_URL, TELEGRAM_PORT)) {
-			// no way, try to connect with fixed IP
-			IPAddress telegramServerIP;
-			telegramServerIP.fromString(TELEGRAM_IP);
-			if (!telegramServer.connect(telegramServerIP, TELEGRAM_PORT)) {
-				serialLog(FSTR("\nUnable to connect to Telegram server\n"), CTBOT_DEBUG_CONNECTION);
-				return("");
-			}
-			else {
-				serialLog(FSTR("\nConnected using fixed IP\n"), CTBOT_DEBUG_CONNECTION);
-				useDNS(false);
+uint8_t CTBotSecureConnection::readResponses(WiFiClientSecure& client, String* responses, uint8_t count) {
+	// wait for the first byte of the response
+	uint32_t phaseStart = millis();
+	bool received = waitForData(client, CTBOT_CONNECTION_TIMEOUT);
+	m_lastRequestStats.firstByteTime = millis() - phaseStart;
+	phaseStart = millis();
+	if (received)
+		traceEvent(CTBotTraceFirstByte);
+
+	// the responses come in the same order of the requests
+	uint8_t receivedCount = 0;
+	while (received && (receivedCount < count)) {
+		received = readResponse(client, responses[receivedCount]);
+		if (received)
+			receivedCount++;
+		else
+			responses[receivedCount] = "";
+	}
+
+	m_lastRequestStats.transferTime = millis() - phaseStart;
+	traceEvent(CTBotTraceResponseEnd, received ? m_lastRequestStats.statusCode : 0);
+	traceHeap();
+	sampleHeap(); // response received
+
+	serialLog(FSTR(" / "), CTBOT_DEBUG_MEMORY);
+	serialLog(ESP.getFreeHeap(), CTBOT_DEBUG_MEMORY);
+	serialLog(FSTR(" - "), CTBOT_DEBUG_MEMORY);
+	serialLog(m_lastRequestStats.sendTime + m_lastRequestStats.firstByteTime + m_lastRequestStats.transferTime, CTBOT_DEBUG_MEMORY);
+	serialLog(FSTR(" ms\n"), CTBOT_DEBUG_MEMORY);
+
+	client.stop();
+
+	if (receivedCount < count) {
+		// timeout (or deadline expired), no JSON to parse
+		m_lastRequestStats.timedOut = true;
+	}
+	return(receivedCount);
+}
+
+bool CTBotSecureConnection::download(const String& path, Stream& sink, uint32_t offset, uint32_t total, CTBotProgressCallback progress,
+	uint32_t& written, uint32_t timeout) {
+	written = 0;
+	beginRequest(timeout);
+	if (0 == timeout)
+		m_requestTimeout = UINT32_MAX;
+
+#if defined(ARDUINO_ARCH_ESP8266)
+	BearSSL::WiFiClientSecure telegramServer;
+#else
+	WiFiClientSecure telegramServer;
+#endif
+	if (!openConnection(telegramServer))
+		return false;
+
+	m_statusPin.toggle();
+
+	// no Accept-Encoding: the files are sent as they are
+	String request = (String)FSTR("GET ") + path + (String)FSTR(" HTTP/1.1\r\nHost: ") + (String)TELEGRAM_URL + (String)FSTR("\r\n");
+	if (offset > 0)
+		request += (String)FSTR("Range: bytes=") + (String)offset + (String)FSTR("-\r\n");
+	request += FSTR("Connection: close\r\n\r\n");
+	uint32_t phaseStart = millis();
+	m_lastRequestStats.bytesOut = telegramServer.print(request);
+	m_lastRequestStats.sendTime = millis() - phaseStart;
+	traceEvent(CTBotTraceRequestSent, m_lastRequestStats.bytesOut);
+
+	m_statusPin.toggle();
+
+	phaseStart = millis();
+	bool received = waitForData(telegramServer, CTBOT_CONNECTION_TIMEOUT);
+	m_lastRequestStats.firstByteTime = millis() - phaseStart;
+	phaseStart = millis();
+
+	int32_t contentLength;
+	bool chunked;
+	received = received && readHeaders(telegramServer, contentLength, chunked);
+	bool complete = false;
+	bool success = received && ((200 == m_lastRequestStats.statusCode) || (206 == m_lastRequestStats.statusCode));
+	if (success) {
+		m_sink          = &sink;
+		m_downloaded    = offset;
+		m_downloadTotal = total;
+		m_progress      = progress;
+		// 200 -> the server ignored the Range request and sent the whole file
+		m_skip          = (200 == m_lastRequestStats.statusCode) ? offset : 0;
+
+		if (chunked) {
+			// chunked transfer encoding: "<hex size>\r\n<data>\r\n" ... "0\r\n\r\n"
+			String line;
+			while (readLine(telegramServer, line)) {
+				uint32_t chunkSize = strtoul(line.c_str(), NULL, 16);
+				if (0 == chunkSize) {
+					complete = true;
+					break;
+				}
+				if (!copyBody(telegramServer, chunkSize) || !readLine(telegramServer, line))
+					break;
 			}
 		}
+		else if (contentLength >= 0)
+			complete = copyBody(telegramServer, contentLength);
 		else {
-			serialLog(FSTR("\nConnected using DNS\n"), CTBOT_DEBUG_CONNECTION);
+			// no length provided: the body ends when the server closes the connection
+			copyBody(telegramServer, UINT32_MAX);
+			complete = !telegramServer.connected() && !m_lastRequestStats.deadlineExpired;
 		}
+		written = m_downloaded - offset;
+		m_sink  = NULL;
 	}
-	else {
-		// try to connect with fixed IP
-		IPAddress telegramServerIP; // (149, 154, 167, 220);
-		telegramServerIP.fromString(TELEGRAM_IP);
-		if (!telegramServer.connect(telegramServerIP, TELEGRAM_PORT)) {
-			serialLog(FSTR("\nUnable to connect to Telegram server\n"), CTBOT_DEBUG_CONNECTION);
-			return("");
+	else if (received) {
+		// an error: the body is a Telegram JSON error, not worth reading
+		serialLog(FSTR("\nDownload error, HTTP status code: "), CTBOT_DEBUG_CONNECTION);
+		serialLog(m_lastRequestStats.statusCode, CTBOT_DEBUG_CONNECTION);
+		serialLog("\n", CTBOT_DEBUG_CONNECTION);
+	}
+
+	m_lastRequestStats.transferTime = millis() - phaseStart;
+	traceEvent(CTBotTraceResponseEnd, received ? m_lastRequestStats.statusCode : 0);
+	sampleHeap();
+	telegramServer.stop();
+
+	if (!complete && success)
+		m_lastRequestStats.timedOut = true;
+	return(complete);
+}
+
+bool CTBotSecureConnection::copyBody(WiFiClient& client, uint32_t length) {
+	uint8_t buffer[CTBOT_DOWNLOAD_BUFFER_SIZE];
+	while (length > 0) {
+		if (!waitForData(client, CTBOT_CONNECTION_TIMEOUT))
+			return false;
+		size_t size = client.available();
+		if (size > CTBOT_DOWNLOAD_BUFFER_SIZE)
+			size = CTBOT_DOWNLOAD_BUFFER_SIZE;
+		if (size > length)
+			size = length;
+		int count = client.read(buffer, size);
+		if (count <= 0)
+			return false;
+		length -= count;
+		m_lastRequestStats.bytesIn += count;
+		traceEvent(CTBotTraceBytesRead, count);
+
+		// skip the bytes already downloaded (the server ignored the Range request)
+		uint32_t start = 0;
+		if (m_skip > 0) {
+			start = (m_skip < (uint32_t)count) ? m_skip : count;
+			m_skip -= start;
+		}
+		if ((uint32_t)count > start) {
+			size_t size = count - start;
+			if (m_sink->write(buffer + start, size) != size) {
+				serialLog(FSTR("\nUnable to write the downloaded file\n"), CTBOT_DEBUG_CONNECTION);
+				return false;
+			}
+			m_downloaded += size;
+			if (m_progress != NULL)
+				m_progress(m_downloaded, m_downloadTotal);
 		}
-		else
-			serialLog(FSTR("\nConnected using fixed IP\n"), CTBOT_DEBUG_CONNECTION);
 	}
+	return true;
+}
 
-	m_statusPin.toggle();
+bool CTBotSecureConnection::readHeaders(WiFiClient& client, int32_t& contentLength, bool& chunked) {
+	String line;
+	contentLength = -1;
+	chunked = false;
 
-	// must filter command + parameters from escape sequences and spaces
-	//	String URL = "GET /bot" + m_token + (String)"/" + toURL(command + parameters);
-//	String URL = (String)FSTR("GET /bot") + m_token + (String)"/" + command + parameters;
+	// status line, i.e. "HTTP/1.1 200 OK"
+	if (!readLine(client, line))
+		return false;
+	if (line.startsWith(FSTR("HTTP/")) && (line.length() >= 12))
+		m_lastRequestStats.statusCode = line.substring(9, 12).toInt();
 
-	unsigned long elapsed = millis();
+	// headers, up to the empty line
+	while (true) {
+		if (!readLine(client, line))
+			return false;
+		if (0 == line.length())
+			break;
 
-	// send the HTTP request
-	telegramServer.println(message);
+		int separator = line.indexOf(':');
+		if (separator <= 0)
+			continue;
+		String name = line.substring(0, separator);
+		String value = line.substring(separator + 1);
+		name.toLowerCase();
+		value.trim();
 
-	m_statusPin.toggle();
+		if (name == FSTR("content-length"))
+			contentLength = value.toInt();
+		else if (name == FSTR("transfer-encoding")) {
+			value.toLowerCase();
+			chunked = (value.indexOf(FSTR("chunked")) >= 0);
+		}
+		else if (name == FSTR("date"))
+			m_lastRequestStats.serverTime = httpDateToUnixTime(value);
+	}
+	return true;
+}
 
-	serialLog(FSTR("--->sendCommand  : Free heap memory: "), CTBOT_DEBUG_MEMORY);
-	serialLog(ESP.getFreeHeap(), CTBOT_DEBUG_MEMORY);
+bool CTBotSecureConnection::readResponse(WiFiClient& client, String& body) {
+	String line;
+	int32_t contentLength;
+	bool chunked;
+
+	if (!readHeaders(client, contentLength, chunked))
+		return false;
+
+	body = "";
+	if (chunked) {
+		// chunked transfer encoding: "<hex size>\r\n<data>\r\n" ... "0\r\n\r\n"
+		while (true) {
+			if (!readLine(client, line))
+				return false;
+			uint32_t chunkSize = strtoul(line.c_str(), NULL, 16);
+			if (0 == chunkSize)
+				break;
+			if (!readBody(client, body, chunkSize))
+				return false;
+			// chunk data trailing CRLF
+			if (!readLine(client, line))
+				return false;
+		}
+		// skip the trailer, up to the empty line
+		while (readLine(client, line) && (line.length() != 0))
+			;
+		return true;
+	}
 
+	if (contentLength >= 0) {
+		// only the response prefix is kept when the body is discarded
+		body.reserve(((m_bodyLimit != 0) && ((uint32_t)contentLength > m_bodyLimit)) ? m_bodyLimit : contentLength);
+		return readBody(client, body, contentLength);
+	}
+
+	// no length provided: the body ends when the server closes the connection
 #if CTBOT_CHECK_JSON == 0
-	serialLog("\n", CTBOT_DEBUG_MEMORY);
-	return(telegramServer.readString());
+	return readBody(client, body, UINT32_MAX) || (body.length() != 0);
 #else
-
-	String response;
-	int curlyCounter; // count the open/closed curly bracket for identify the json
+	// ...or when the JSON ends, without waiting for the connection close
+	int curlyCounter = -1; // count the open/closed curly bracket for identify the json
 	bool skipCounter = false; // for filtering curly bracket inside a text message
 	int c;
-	curlyCounter = -1;
-	response = "";
-
-	while (telegramServer.connected()) {
-		while (telegramServer.available()) {
-			c = telegramServer.read();
-			response += (char)c;
-			if (c == '\\') {
-				// escape character -> read next and skip
-				c = telegramServer.read();
-				response += (char)c;
-				continue;
+	while ((c = readByte(client)) >= 0) {
+		appendBody(body, (char)c);
+		if (c == '\\') {
+			// escape character -> read next and skip
+			c = readByte(client);
+			if (c < 0)
+				return false;
+			appendBody(body, (char)c);
+			continue;
+		}
+		if (c == '"')
+			skipCounter = !skipCounter;
+		if (!skipCounter) {
+			if (c == '{') {
+				if (curlyCounter == -1)
+					curlyCounter = 1;
+				else
+					curlyCounter++;
 			}
-			if (c == '"')
-				skipCounter = !skipCounter;
-			if (!skipCounter) {
-				if (c == '{') {
-					if (curlyCounter == -1)
-						curlyCounter = 1;
-					else
-						curlyCounter++;
-				}
-				else if (c == '}')
-					curlyCounter--;
-				if (curlyCounter == 0) {
+			else if (c == '}')
+				curlyCounter--;
+			if (curlyCounter == 0)
+				return true;
+		}
+	}
+	return false;
+#endif
+}
+
+bool CTBotSecureConnection::connectTo(WiFiClientSecure& client, const IPAddress& address) {
+#if defined(ARDUINO_ARCH_ESP32)
+	// always the cached address, the host name goes in the SNI extension only: without it the
+	// Telegram server could send a different certificate and the validation would fail
+	const String host = TELEGRAM_URL;
+	const char* CAcert = NULL;
+#if CTBOT_USE_FINGERPRINT == 1
+	if (0 == m_certPin.length())
+		CAcert = m_CAcert;
+#endif
+	if (0 == client.connect(address, TELEGRAM_PORT, host.c_str(), CAcert, NULL, NULL))
+		return false;
+	if ((m_certPin.length() != 0) && !client.verify(m_certPin.c_str(), NULL)) {
+		serialLog(FSTR("\nThe Telegram server certificate doesn't match the pinned one\n"), CTBOT_DEBUG_CONNECTION);
+		client.stop();
+		return false;
+	}
+	return true;
+#else
+	// always the cached address: connecting by name the client would resolve it again. The ESP8266
+	// client has no way to send the SNI with an IP address: like the fixed IP mode of the previous
+	// versions, the handshake works without it (fingerprint and key pinning check the default certificate)
+	return(client.connect(address, TELEGRAM_PORT) != 0);
+#endif
+}
 
-					// JSON ended, close connection and return JSON
+#if defined(ARDUINO_ARCH_ESP8266)
+void CTBotSecureConnection::setBufferSizes(BearSSL::WiFiClientSecure& client, const IPAddress& address) {
+	// one more TLS hello, only once: the result is cached. The probe can't be interrupted by the
+	// request deadline, so it's done only when the time left covers both the probe and the connection.
+	// Otherwise this connection gets the full rx buffer and the probe waits for a later request
+	bool probe = !m_mflnProbed && (getTimeLeft(2 * CTBOT_CONNECTION_TIMEOUT) == 2 * CTBOT_CONNECTION_TIMEOUT);
+	if (probe) {
+		m_mflnSupported = BearSSL::WiFiClientSecure::probeMaxFragmentLength(address, TELEGRAM_PORT, CTBOT_ESP8266_TCP_BUFFER_SIZE);
+		m_mflnProbed = true;
+		serialLog(m_mflnSupported ? FSTR("MFLN supported\n") : FSTR("MFLN not supported\n"), CTBOT_DEBUG_CONNECTION);
+	}
 
-					elapsed = millis() - elapsed;
+	// the tx records are built by the client: the tx buffer can always be small
+	if (m_mflnProbed && m_mflnSupported)
+		client.setBufferSizes(CTBOT_ESP8266_TCP_BUFFER_SIZE, CTBOT_ESP8266_TCP_BUFFER_SIZE);
+	else
+		client.setBufferSizes(CTBOT_ESP8266_TLS_MAX_RX, CTBOT_ESP8266_TCP_BUFFER_SIZE);
+}
+#endif
 
-					serialLog(FSTR(" / "), CTBOT_DEBUG_MEMORY);
-					serialLog(ESP.getFreeHeap(), CTBOT_DEBUG_MEMORY);
-					serialLog(FSTR(" - "), CTBOT_DEBUG_MEMORY);
-					serialLog(elapsed, CTBOT_DEBUG_MEMORY);
-					serialLog(FSTR(" ms\n"), CTBOT_DEBUG_MEMORY);
+void CTBotSecureConnection::setDNSCacheTTL(uint32_t ttl) {
+	m_endpoints.setTTL(ttl);
+}
 
-					telegramServer.flush();
-					telegramServer.stop();
-					return(response);
-				}
-			}
-		}
+bool CTBotSecureConnection::addFallbackIP(const String& ip) {
+	return(m_endpoints.addFallbackIP(ip));
+}
+
+void CTBotSecureConnection::clearFallbackIPs() {
+	m_endpoints.clearFallbackIPs();
+}
+
+void CTBotSecureConnection::sampleHeap() {
+	uint32_t freeHeap  = ESP.getFreeHeap();
+	uint32_t freeBlock = getMaxFreeBlockSize();
+	if ((0 == m_lastRequestStats.minFreeHeap) || (freeHeap < m_lastRequestStats.minFreeHeap))
+		m_lastRequestStats.minFreeHeap = freeHeap;
+	if ((0 == m_lastRequestStats.minFreeBlock) || (freeBlock < m_lastRequestStats.minFreeBlock))
+		m_lastRequestStats.minFreeBlock = freeBlock;
+}
+
+uint32_t CTBotSecureConnection::getTimeLeft(uint32_t timeout) {
+	uint32_t elapsed = millis() - m_requestStart;
+	if (elapsed >= m_requestTimeout) {
+		if (!m_lastRequestStats.deadlineExpired)
+			serialLog(FSTR("\nRequest deadline expired\n"), CTBOT_DEBUG_CONNECTION);
+		m_lastRequestStats.deadlineExpired = true;
+		return 0;
 	}
+	if (timeout > m_requestTimeout - elapsed)
+		timeout = m_requestTimeout - elapsed;
+	return timeout;
+}
 
-	serialLog("\n", CTBOT_DEBUG_MEMORY);
+bool CTBotSecureConnection::waitForData(WiFiClient& client, uint32_t timeout) {
+	timeout = getTimeLeft(timeout);
+	uint32_t startTime = millis();
+	while (!client.available()) {
+		if (!client.connected() || ((millis() - startTime) >= timeout))
+			return false;
+		delay(1);
+	}
+	return true;
+}
 
-	// timeout, no JSON to parse
-	telegramServer.flush();
-	telegramServer.stop();
-	return("");
-#endif
-}
\ No newline at end of file
+int CTBotSecureConnection::readByte(WiFiClient& client) {
+	if (!waitForData(client, CTBOT_CONNECTION_TIMEOUT))
+		return -1;
+	m_lastRequestStats.bytesIn++;
+	return client.read();
+}
+
+bool CTBotSecureConnection::readLine(WiFiClient& client, String& line) {
+	int c;
+	line = "";
+	while ((c = readByte(client)) >= 0) {
+		if ('\n' == c)
+			return true;
+		if (c != '\r')
+			line += (char)c;
+	}
+	return false;
+}
+
+bool CTBotSecureConnection::readBody(WiFiClient& client, String& body, uint32_t length) {
+	char buffer[CTBOT_READ_BUFFER_SIZE + 1];
+	while (length > 0) {
+		if (!waitForData(client, CTBOT_CONNECTION_TIMEOUT))
+			return false;
+		size_t size = client.available();
+		if (size > CTBOT_READ_BUFFER_SIZE)
+			size = CTBOT_READ_BUFFER_SIZE;
+		if (size > length)
+			size = length;
+		int count = client.read((uint8_t*)buffer, size);
+		if (count <= 0)
+			return false;
+		// only the beginning of a discarded body is kept
+		uint32_t kept = count;
+		if ((m_bodyLimit != 0) && (body.length() + kept > m_bodyLimit))
+			kept = (body.length() < m_bodyLimit) ? m_bodyLimit - body.length() : 0;
+		buffer[kept] = 0x00;
+		body += buffer;
+		length -= count;
+		m_lastRequestStats.bytesIn += count;
+		traceEvent(CTBotTraceBytesRead, count);
+	}
+	return true;
+}
+
+void CTBotSecureConnection::appendBody(String& body, char c) {
+	if ((0 == m_bodyLimit) || (body.length() < m_bodyLimit))
+		body += c;
+}
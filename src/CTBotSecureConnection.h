@@ -3,18 +3,23 @@
 #define CTBOTSECURECONNECTION
 
 #include <Arduino.h>
+#include <WiFiClientSecure.h>
 #include "CTBotStatusPin.h"
+#include "CTBotDataStructures.h"
 #include "CTBotDefines.h"
+#include "CTBotMetrics.h"
+#include "CTBotEndpoints.h"
 
 class CTBotSecureConnection
 {
 public:
 	CTBotSecureConnection();
+	~CTBotSecureConnection();
 
-	// use the URL style address "api.telegram.org" or the fixed IP address "149.154.167.198"
-	// for all communication with the telegram server. When changing to true a test 
-	// connection is made using the URL. If no connection is made useDNS falls back to false. 
-	// Default value is false
+	// use the URL style address "api.telegram.org" or the fixed IP addresses (fallback IPs)
+	// for all communication with the telegram server. When the resolved address doesn't work,
+	// the fallback IPs are used and the name is resolved again on the next request.
+	// Default value is true
 	// params
 	//   value: true  -> use URL style address
 	//          false -> use fixed IP addres
@@ -29,6 +34,24 @@ public:
 	//    newFingerprint: the array of 20 bytes that contains the new fingerprint
 	void setFingerprint(const uint8_t* newFingerprint);
 
+	// set the preferred TLS cipher suites, i.e. the cheaper ECDHE-ECDSA ones (only for ESP8266)
+	// params
+	//   suites: the cipher suite IDs (i.e. BR_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256), by preference
+	//   count : the number of suites, up to CTBOT_MAX_CIPHER_SUITES. Zero -> BearSSL default list
+	// returns
+	//   true if no error occurred
+	bool setCipherSuites(const uint16_t* suites, uint8_t count);
+
+	// pin the Telegram server: the pin is checked instead of the certificate chain (or the fingerprint)
+	// params
+	//   pin: ESP8266 -> the server public key, PEM format
+	//        ESP32   -> the SHA-256 fingerprint of the server certificate, hex format (the Arduino
+	//                   ESP32 client can't pin a public key)
+	//        NULL or empty -> remove the pin
+	// returns
+	//   true if no error occurred (valid key)
+	bool setServerKeyPin(const char* pin);
+
 	// set the status pin used to connect a LED for visual notification
 	// CTBOT_DISABLE_STATUS_PIN will disable the notification
 	// default value is CTBOT_DISABLE_STATUS_PIN (visual notification disabled)
@@ -38,11 +61,223 @@ public:
 	//   pin: the pin used for visual notification
 	void setStatusPin(int8_t pin);
 
-	String send(const String& message);
+	// send an HTTP/1.1 GET request to the Telegram server
+	// params
+	//   path   : the requested path, i.e. /bot<token>/getMe
+	//   timeout: the request deadline (connection, request write and response read), in milliseconds.
+	//            Zero -> CTBOT_REQUEST_TIMEOUT
+	//   discardBody: true -> fire-and-forget request, only the first CTBOT_RESPONSE_PREFIX_SIZE bytes of
+	//                the response body are kept (i.e. {"ok":true), the rest is read and discarded
+	// returns
+	//   the response body or an empty string if an error occurred (or the deadline expired)
+	String send(const String& path, uint32_t timeout = 0, bool discardBody = false);
+
+	// send several HTTP/1.1 GET requests to the Telegram server on the same connection: the requests
+	// are written back-to-back (pipelining), then the responses are read in order
+	// params
+	//   paths    : the requested paths
+	//   responses: the array that will contain the response bodies (empty if an error occurred)
+	//   count    : the number of requests
+	//   timeout  : the deadline of the whole batch, in milliseconds. Zero -> CTBOT_REQUEST_TIMEOUT
+	//   discardBody: true -> keep only the beginning of every response body (see send())
+	//   pathSuffix : appended to every path while writing the requests, so a long common part (i.e. the
+	//                URL encoded text of a broadcast) is stored only once
+	// returns
+	//   the number of responses received
+	uint8_t sendBatch(const String* paths, String* responses, uint8_t count, uint32_t timeout = 0, bool discardBody = false,
+		const String& pathSuffix = "");
+
+	// send an HTTP/1.1 POST request with a multipart/form-data body that contains a single file. The file
+	// is streamed in CTBOT_UPLOAD_BUFFER_SIZE bytes pieces, so the used memory doesn't depend on its size
+	// params
+	//   path    : the requested path with the query string, i.e. /bot<token>/sendPhoto?chat_id=123
+	//   field   : the form field of the file, i.e. photo
+	//   fileName: the file name sent to the Telegram server
+	//   data    : the file content
+	//   size    : the file size, in bytes (Content-Length). Zero -> unknown size: chunked transfer
+	//             encoding, the file ends when data has no more bytes available
+	//   timeout : the request deadline, in milliseconds. Zero -> CTBOT_REQUEST_TIMEOUT
+	// returns
+	//   the response body or an empty string if an error occurred (or the deadline expired)
+	String upload(const String& path, const String& field, const String& fileName, Stream& data, uint32_t size, uint32_t timeout = 0);
+
+	// download a file from the Telegram server, writing it into a sink through a fixed buffer
+	// (CTBOT_DOWNLOAD_BUFFER_SIZE bytes), so the used memory doesn't depend on the file size
+	// params
+	//   path    : the requested path, i.e. /file/bot<token>/documents/file_1.bin
+	//   sink    : where to write the file
+	//   offset  : the bytes already downloaded: the download resumes from here (HTTP Range request)
+	//   total   : the file size (only for the progress callback), zero if unknown
+	//   progress: the progress callback, NULL -> no callback
+	//   written : will contain the bytes written into the sink by this call
+	//   timeout : the download deadline, in milliseconds. Zero -> no deadline (every read still waits
+	//             for CTBOT_CONNECTION_TIMEOUT at most)
+	// returns
+	//   true if the whole file was received (check getLastRequestStats().statusCode for the HTTP errors)
+	bool download(const String& path, Stream& sink, uint32_t offset, uint32_t total, CTBotProgressCallback progress,
+		uint32_t& written, uint32_t timeout = 0);
+
+	// set how long a resolved Telegram server address is cached
+	// params
+	//   ttl: the time to live, in seconds
+	void setDNSCacheTTL(uint32_t ttl);
+
+	// add a fallback IP for the Telegram server. By default the list contains 149.154.167.220
+	// params
+	//   ip: the IP address
+	// returns
+	//   true if no error occurred
+	bool addFallbackIP(const String& ip);
+
+	// remove all the fallback IPs
+	void clearFallbackIPs();
+
+	// get the statistics of the last request made with send() (or of the last batch made with sendBatch())
+	// returns
+	//   the statistics of the last request
+	const CTBotRequestStats& getLastRequestStats() const;
 
 private:
-	bool            m_useDNS;
-	CTBotStatusPin  m_statusPin;
+	bool              m_useDNS;
+	CTBotRequestStats m_lastRequestStats;
+	CTBotEndpoints    m_endpoints;
+	CTBotStatusPin    m_statusPin;
+	uint32_t          m_requestStart;   // millis() when the current request started
+	uint32_t          m_requestTimeout; // deadline of the current request, in milliseconds
+
+	// get how long an operation of the current request can last: the operation timeout,
+	// shortened to the time left before the request deadline
+	// params
+	//   timeout: the operation timeout, in milliseconds
+	// returns
+	//   the time left, in milliseconds. Zero if the deadline expired
+	uint32_t getTimeLeft(uint32_t timeout);
+
+	// connect to a Telegram server address (TCP connection and TLS handshake)
+	// params
+	//   client : the secure client
+	//   address: the Telegram server address
+	// returns
+	//   true if connected
+	bool connectTo(WiFiClientSecure& client, const IPAddress& address);
+
+	// start a new request: clear the statistics and start the deadline. The deadline covers the name
+	// resolution (ESP8266 only, the ESP32 resolver can't be given a timeout), the connection, the
+	// request and the response
+	// params
+	//   timeout: the request deadline, in milliseconds. Zero -> CTBOT_REQUEST_TIMEOUT
+	void beginRequest(uint32_t timeout);
+
+	// set up the TLS validation, resolve the Telegram server name (if needed) and connect to the
+	// first available candidate address
+	// params
+	//   client: the secure client, not yet connected
+	// returns
+	//   true if connected and there is still time to write the request
+	bool openConnection(WiFiClientSecure& client);
+
+	// write a piece of a request body, within the request deadline
+	// params
+	//   client : the connection
+	//   data   : the bytes to write
+	//   length : the number of bytes
+	//   chunked: true -> write the piece as a chunk (chunked transfer encoding)
+	// returns
+	//   true if all the bytes were written
+	bool writeBody(WiFiClient& client, const uint8_t* data, size_t length, bool chunked);
+
+	// read the responses of the pipelined requests, then close the connection
+	// params
+	//   client   : the connection
+	//   responses: the array that will contain the response bodies
+	//   count    : the number of requests sent
+	// returns
+	//   the number of responses received
+	uint8_t readResponses(WiFiClientSecure& client, String* responses, uint8_t count);
+
+#if defined(ARDUINO_ARCH_ESP8266)
+	BearSSL::Session    m_session;     // TLS session, resumed by the next connection (abbreviated handshake)
+	BearSSL::PublicKey* m_serverKey;   // pinned server public key, NULL if not pinned
+	uint16_t            m_ciphers[CTBOT_MAX_CIPHER_SUITES];
+	uint8_t             m_cipherCount;
+#elif defined(ARDUINO_ARCH_ESP32)
+	String              m_certPin;     // pinned server certificate SHA-256 fingerprint, empty if not pinned
+#endif
+
+#if defined(ARDUINO_ARCH_ESP8266)
+	bool m_mflnProbed;    // the Telegram server Max Fragment Length support was probed
+	bool m_mflnSupported; // the Telegram server honours small TLS records
+
+	// size the TLS buffers: small buffers if the Telegram server supports the Max Fragment Length
+	// extension (probed once, on the first connection with enough time left before the deadline),
+	// a full TLS record rx buffer otherwise
+	// params
+	//   client : the secure client, not yet connected
+	//   address: the Telegram server address used to probe
+	void setBufferSizes(BearSSL::WiFiClientSecure& client, const IPAddress& address);
+#endif
+
+	// sample the free heap and the largest free block, updating the request low-water marks
+	void sampleHeap();
+
+	// wait until some data is available
+	// params
+	//   client : the connection
+	//   timeout: max waiting time, in milliseconds (never beyond the request deadline)
+	// returns
+	//   true if there is data to read, false if the time is over or the connection was closed
+	bool waitForData(WiFiClient& client, uint32_t timeout);
+
+	// read a single byte of the response
+	// returns
+	//   the byte or -1 if the time is over or the connection was closed
+	int readByte(WiFiClient& client);
+
+	// read a response line, stripping the CR/LF terminator
+	// returns
+	//   true if the whole line was read
+	bool readLine(WiFiClient& client, String& line);
+
+	// read <length> bytes of the response body, appending them to <body>
+	// returns
+	//   true if all the bytes were read
+	bool readBody(WiFiClient& client, String& body, uint32_t length);
+
+	// copy <length> bytes of the response body into the sink
+	// returns
+	//   true if all the bytes were copied
+	bool copyBody(WiFiClient& client, uint32_t length);
+
+	// max response body bytes kept, the rest is read and discarded. Zero -> the whole body
+	uint16_t m_bodyLimit;
+
+	// append a response body byte, up to m_bodyLimit bytes
+	void appendBody(String& body, char c);
+
+	// read the HTTP response status line and headers
+	// params
+	//   client       : the connection
+	//   contentLength: will contain the body length, -1 if unknown
+	//   chunked      : will be true if the body uses the chunked transfer encoding
+	// returns
+	//   true if the whole header was read
+	bool readHeaders(WiFiClient& client, int32_t& contentLength, bool& chunked);
+
+	// read the HTTP response (status line, headers and body)
+	// params
+	//   client: the connection
+	//   body  : the string that will contain the response body
+	// returns
+	//   true if the whole response was read
+	bool readResponse(WiFiClient& client, String& body);
+
+	// download state, used to copy a response body into a sink
+	Stream*               m_sink;
+	uint32_t              m_skip;       // bytes to skip before writing (the server ignored the Range request)
+	uint32_t              m_downloaded; // bytes downloaded so far, previous attempts included
+	uint32_t              m_downloadTotal;
+	CTBotProgressCallback m_progress;
+
 	// get fingerprints from https://www.grc.com/fingerprints.htm
 	uint8_t m_fingerprint[20]{ 0xF2, 0xAD, 0x29, 0x9C, 0x34, 0x48, 0xDD, 0x8D, 0xF4, 0xCF, 0x52, 0x32, 0xF6, 0x57, 0x33, 0x68, 0x2E, 0x81, 0xC1, 0x90 }; // use this preconfigured fingerprrint by default
 
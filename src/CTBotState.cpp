@@ -0,0 +1,161 @@
+#include "CTBotState.h"
+#include "Utilities.h"
+
+// state file format version, the first line of the file
+#define CTBOT_STATE_MAGIC "CTBotState1"
+
+CTBotState::CTBotState() {
+	m_fs           = NULL;
+	m_tokenHash    = 0;
+	m_offset       = 0;
+	m_hasIdentity  = false;
+	m_dirty        = false;
+	m_pendingCount = 0;
+	m_dirtyTime    = 0;
+	m_identity.id    = 0;
+	m_identity.isBot = false;
+}
+
+bool CTBotState::begin(fs::FS& fs, const String& fileName, const String& token) {
+	m_fs          = &fs;
+	m_fileName    = fileName;
+	m_tokenHash   = hashToken(token);
+	m_offset      = 0;
+	m_hasIdentity = false;
+	m_dirty       = false;
+	m_pendingCount = 0;
+	return(load());
+}
+
+bool CTBotState::isEnabled(void) {
+	return(m_fs != NULL);
+}
+
+int32_t CTBotState::getOffset(void) {
+	return(m_offset);
+}
+
+void CTBotState::setOffset(int32_t offset) {
+	if ((NULL == m_fs) || (offset == m_offset))
+		return;
+	m_offset = offset;
+	if (!m_dirty)
+		m_dirtyTime = millis();
+	m_dirty = true;
+	m_pendingCount++;
+	if (m_pendingCount >= CTBOT_STATE_UPDATES)
+		save();
+}
+
+bool CTBotState::getIdentity(TBUser& user) {
+	if (!m_hasIdentity)
+		return false;
+	user = m_identity;
+	return true;
+}
+
+void CTBotState::setIdentity(const TBUser& user) {
+	if (NULL == m_fs)
+		return;
+	if (m_hasIdentity && (m_identity.id == user.id) && (m_identity.username == user.username) &&
+		(m_identity.firstName == user.firstName) && (m_identity.lastName == user.lastName))
+		return;
+	m_identity    = user;
+	m_hasIdentity = true;
+	if (!m_dirty)
+		m_dirtyTime = millis();
+	m_dirty = true;
+	save();
+}
+
+void CTBotState::clearIdentity(void) {
+	if (!m_hasIdentity)
+		return;
+	m_hasIdentity = false;
+	if (!m_dirty)
+		m_dirtyTime = millis();
+	m_dirty = true;
+	save();
+}
+
+void CTBotState::update(void) {
+	if (m_dirty && ((millis() - m_dirtyTime) >= CTBOT_STATE_INTERVAL))
+		save();
+}
+
+bool CTBotState::save(void) {
+	if ((NULL == m_fs) || !m_dirty)
+		return true;
+
+	// the whole state in a single small write: a torn write is detected by load()
+	char hash[9];
+	ultoa(m_tokenHash, hash, 16);
+	String state = (String)FSTR(CTBOT_STATE_MAGIC) + (String)"\n" + (String)hash + (String)"\n" + (String)m_offset + (String)"\n";
+	if (m_hasIdentity) {
+		state += int64ToAscii(m_identity.id) + (String)"\n" + (String)(m_identity.isBot ? "1" : "0") + (String)"\n" +
+			m_identity.firstName + (String)"\n" + m_identity.lastName + (String)"\n" +
+			m_identity.username + (String)"\n" + m_identity.languageCode + (String)"\n";
+	}
+	state += FSTR("end\n");
+
+	fs::File file = m_fs->open(m_fileName, "w");
+	if (!file) {
+		serialLog(FSTR("CTBotState: unable to write the state file\n"), CTBOT_DEBUG_CONNECTION);
+		return false;
+	}
+	bool result = (file.print(state) == state.length());
+	file.close();
+
+	m_dirty        = !result;
+	m_pendingCount = 0;
+	m_dirtyTime    = millis();
+	return(result);
+}
+
+uint32_t CTBotState::hashToken(const String& token) {
+	uint32_t hash = 2166136261UL;
+	for (uint16_t i = 0; i < token.length(); i++) {
+		hash ^= (uint8_t)token[i];
+		hash *= 16777619UL;
+	}
+	return(hash);
+}
+
+bool CTBotState::load(void) {
+	if (!m_fs->exists(m_fileName.c_str()))
+		return false;
+	fs::File file = m_fs->open(m_fileName, "r");
+	if (!file)
+		return false;
+
+	String lines[10];
+	uint8_t count = 0;
+	while (file.available() && (count < 10)) {
+		lines[count] = file.readStringUntil('\n');
+		count++;
+	}
+	file.close();
+
+	// magic, token hash, offset, [identity (6 lines)], end
+	if ((count < 4) || (lines[0] != FSTR(CTBOT_STATE_MAGIC)) || (lines[count - 1] != FSTR("end")) ||
+		((count != 4) && (count != 10))) {
+		serialLog(FSTR("CTBotState: invalid state file\n"), CTBOT_DEBUG_CONNECTION);
+		return false;
+	}
+	if (strtoul(lines[1].c_str(), NULL, 16) != m_tokenHash) {
+		serialLog(FSTR("CTBotState: state file of a different token\n"), CTBOT_DEBUG_CONNECTION);
+		return false;
+	}
+
+	m_offset = lines[2].toInt();
+	if (10 == count) {
+		m_identity.id           = strtoll(lines[3].c_str(), NULL, 10);
+		m_identity.isBot        = (lines[4] == "1");
+		m_identity.firstName    = lines[5];
+		m_identity.lastName     = lines[6];
+		m_identity.username     = lines[7];
+		m_identity.languageCode = lines[8];
+		m_hasIdentity = true;
+	}
+	return true;
+}
@@ -0,0 +1,84 @@
+#pragma once
+#ifndef CTBOT_STATE
+#define CTBOT_STATE
+
+#include <Arduino.h>
+#include <FS.h>
+#include "CTBotDataStructures.h"
+#include "CTBotDefines.h"
+
+// bot state persisted to a flash file system (LittleFS/SPIFFS): the update offset and the bot
+// identity (getMe). After a reboot the bot restarts from the stored offset, without downloading
+// the already handled updates again. The offset writes are batched to spare the flash
+class CTBotState
+{
+public:
+	CTBotState();
+
+	// set the file system and the file used to store the state, then load it
+	// params
+	//   fs      : the file system (i.e. LittleFS), already mounted
+	//   fileName: the state file
+	//   token   : the bot token. A state stored with a different token is discarded
+	// returns
+	//   true if a valid state was loaded
+	bool begin(fs::FS& fs, const String& fileName, const String& token);
+
+	// check if the persistence is enabled (begin() called)
+	bool isEnabled(void);
+
+	// get the stored update offset
+	// returns
+	//   the offset, zero if unknown
+	int32_t getOffset(void);
+
+	// update the offset. The state is written every CTBOT_STATE_UPDATES offset changes or
+	// CTBOT_STATE_INTERVAL milliseconds after the first unsaved change (see update())
+	// params
+	//   offset: the new update offset
+	void setOffset(int32_t offset);
+
+	// get the stored bot identity
+	// params
+	//   user: the structure that will contain the identity
+	// returns
+	//   true if an identity is stored
+	bool getIdentity(TBUser& user);
+
+	// store the bot identity. The state is written immediately only if the identity changed
+	// params
+	//   user: the bot identity (getMe result)
+	void setIdentity(const TBUser& user);
+
+	// forget the stored identity (i.e. the token was revoked)
+	void clearIdentity(void);
+
+	// write the state if the unsaved offset changes are old enough. Call it periodically
+	void update(void);
+
+	// write the state now, if there are unsaved changes (i.e. before a deep sleep or an OTA update)
+	// returns
+	//   true if no error occurred
+	bool save(void);
+
+private:
+	fs::FS*  m_fs;
+	String   m_fileName;
+	uint32_t m_tokenHash;
+	int32_t  m_offset;
+	TBUser   m_identity;
+	bool     m_hasIdentity;
+	bool     m_dirty;        // there are unsaved changes
+	uint16_t m_pendingCount; // unsaved offset changes
+	uint32_t m_dirtyTime;    // millis() of the first unsaved change
+
+	// hash the token (FNV-1a), so the secret is not stored in the flash
+	static uint32_t hashToken(const String& token);
+
+	// load the state file
+	// returns
+	//   true if the file is valid and stored with the same token
+	bool load(void);
+};
+
+#endif
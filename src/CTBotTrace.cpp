@@ -0,0 +1,58 @@
+#include "CTBotTrace.h"
+
+#if CTBOT_TRACE_SIZE > 0
+
+#define CTBOT_TRACE_VERSION     1
+#define CTBOT_TRACE_RECORD_SIZE 8
+
+static uint32_t traceBuffer[CTBOT_TRACE_SIZE][2];
+static uint16_t traceHead     = 0; // next record to write
+static uint16_t traceCount    = 0; // stored records
+static uint32_t traceHeapLow  = UINT32_MAX;
+
+void traceEvent(CTBotTraceEvent event, uint32_t value) {
+	traceBuffer[traceHead][0] = micros();
+	traceBuffer[traceHead][1] = ((uint32_t)event << 24) | (value & 0x00FFFFFF);
+	traceHead = (traceHead + 1) % CTBOT_TRACE_SIZE;
+	if (traceCount < CTBOT_TRACE_SIZE)
+		traceCount++;
+}
+
+void traceHeap() {
+	uint32_t freeHeap = ESP.getFreeHeap();
+	if (freeHeap < traceHeapLow) {
+		traceHeapLow = freeHeap;
+		traceEvent(CTBotTraceHeapLow, freeHeap);
+	}
+}
+
+static void traceWrite32(Print& out, uint32_t value) {
+	uint8_t buffer[4];
+	buffer[0] = value & 0xFF;
+	buffer[1] = (value >> 8) & 0xFF;
+	buffer[2] = (value >> 16) & 0xFF;
+	buffer[3] = (value >> 24) & 0xFF;
+	out.write(buffer, 4);
+}
+
+void traceDump(Print& out) {
+	uint8_t header[8] = { 'C', 'T', 'B', 'T', CTBOT_TRACE_VERSION, CTBOT_TRACE_RECORD_SIZE,
+		(uint8_t)(traceCount & 0xFF), (uint8_t)(traceCount >> 8) };
+	out.write(header, sizeof(header));
+
+	// oldest record first
+	uint16_t index = (traceHead + CTBOT_TRACE_SIZE - traceCount) % CTBOT_TRACE_SIZE;
+	for (uint16_t i = 0; i < traceCount; i++) {
+		traceWrite32(out, traceBuffer[index][0]);
+		traceWrite32(out, traceBuffer[index][1]);
+		index = (index + 1) % CTBOT_TRACE_SIZE;
+	}
+}
+
+void traceClear() {
+	traceHead    = 0;
+	traceCount   = 0;
+	traceHeapLow = UINT32_MAX;
+}
+
+#endif
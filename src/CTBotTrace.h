@@ -0,0 +1,64 @@
+#pragma once
+#ifndef CTBOTTRACE
+#define CTBOTTRACE
+
+#include <Arduino.h>
+#include "CTBotDefines.h"
+
+// hot path events recorded in the trace ring buffer
+enum CTBotTraceEvent {
+	CTBotTraceRequestStart  = 1,  // value: API method (CTBotApiMethod)
+	CTBotTraceDNSStart      = 2,
+	CTBotTraceDNSEnd        = 3,  // value: 1 resolved, 0 failed
+	CTBotTraceConnectStart  = 4,
+	CTBotTraceConnectEnd    = 5,  // TCP connected and TLS handshake done. value: 1 connected, 0 failed
+	CTBotTraceRequestSent   = 6,  // value: bytes sent
+	CTBotTraceFirstByte     = 7,
+	CTBotTraceBytesRead     = 8,  // value: bytes read
+	CTBotTraceResponseEnd   = 9,  // value: HTTP status code (zero -> no/incomplete response)
+	CTBotTraceRequestEnd    = 10, // value: bytes received
+	CTBotTraceParseStart    = 11,
+	CTBotTraceParseEnd      = 12, // value: 1 parsed, 0 deserialization error
+	CTBotTraceHeapLow       = 13  // new free heap low-water mark. value: free heap, in bytes
+};
+
+// The trace is a fixed size ring buffer of compact binary records (8 bytes each):
+//   uint32_t timestamp (micros())
+//   uint32_t event << 24 | value (24 bits)
+// When the ring is full, the oldest records are overwritten.
+// It is enabled by CTBOT_TRACE_SIZE > 0 (see CTBotDefines.h). With CTBOT_TRACE_SIZE = 0
+// all the trace functions are empty and no memory is used.
+//
+// traceDump() output format (little endian):
+//   "CTBT"             magic
+//   uint8_t  version   (1)
+//   uint8_t  record size (8)
+//   uint16_t record count
+//   records, from the oldest to the newest
+// Use extras/traceDecoder/ctbot_trace.py to decode the dump into a timeline.
+
+#if CTBOT_TRACE_SIZE > 0
+// add an event to the trace
+// params
+//   event: the event type
+//   value: the event value (only the lower 24 bits are stored)
+void traceEvent(CTBotTraceEvent event, uint32_t value = 0);
+
+// sample the free heap and add a CTBotTraceHeapLow event if it is a new low-water mark
+void traceHeap();
+
+// write the trace content (binary format) to a stream
+// params
+//   out: where to write the trace (i.e. Serial)
+void traceDump(Print& out);
+
+// clear the trace content
+void traceClear();
+#else
+inline void traceEvent(CTBotTraceEvent, uint32_t = 0) {}
+inline void traceHeap() {}
+inline void traceDump(Print&) {}
+inline void traceClear() {}
+#endif
+
+#endif
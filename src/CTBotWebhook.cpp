@@ -0,0 +1,67 @@
+#include "CTBotWebhook.h"
+#include "Utilities.h"
+
+CTBotWebhook::CTBotWebhook() {
+	m_server = NULL;
+}
+
+CTBotWebhook::~CTBotWebhook() {
+	end();
+}
+
+bool CTBotWebhook::begin(uint16_t port, const String& path, const String& secretToken) {
+	end();
+	if ((0 == port) || !path.startsWith("/"))
+		return false;
+	m_handler.begin(path, secretToken);
+	m_server = new WiFiServer(port);
+	if (NULL == m_server)
+		return false;
+	m_server->begin();
+	String message = (String)FSTR("Webhook listening on port ") + (String)port + (String)"\n";
+	serialLog(message, CTBOT_DEBUG_CONNECTION);
+	return true;
+}
+
+void CTBotWebhook::end(void) {
+	if (m_server != NULL) {
+		m_server->stop();
+		delete m_server;
+		m_server = NULL;
+	}
+	m_handler.clear();
+}
+
+bool CTBotWebhook::isRunning(void) {
+	return(m_server != NULL);
+}
+
+void CTBotWebhook::handleClient(void) {
+	if (NULL == m_server)
+		return;
+	WiFiClient client = m_server->available();
+	if (!client)
+		return;
+	m_handler.handleRequest(client);
+	client.stop();
+}
+
+uint16_t CTBotWebhook::handleRequest(Stream& client) {
+	return(m_handler.handleRequest(client));
+}
+
+uint8_t CTBotWebhook::getCount(void) {
+	return(m_handler.getCount());
+}
+
+bool CTBotWebhook::pop(String& update) {
+	return(m_handler.pop(update));
+}
+
+uint32_t CTBotWebhook::getReceived(void) {
+	return(m_handler.getReceived());
+}
+
+uint32_t CTBotWebhook::getRejected(void) {
+	return(m_handler.getRejected());
+}
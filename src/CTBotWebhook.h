@@ -0,0 +1,71 @@
+#pragma once
+#ifndef CTBOT_WEBHOOK
+#define CTBOT_WEBHOOK
+
+#include <Arduino.h>
+#include "CTBotDefines.h"
+#include "CTBotWebhookHandler.h"
+
+#if defined(ARDUINO_ARCH_ESP8266) // ESP8266
+#include <ESP8266WiFi.h>
+#elif defined(ARDUINO_ARCH_ESP32) // ESP32
+#include <WiFi.h>
+#endif
+
+// webhook receiver: a small HTTP listener that takes the updates POSTed by the Telegram server
+// (or by a TLS terminating proxy) and queues their JSON bodies (see CTBotWebhookHandler). The updates
+// are decoded later, by getNewMessage(), with the same parser of the polled ones
+class CTBotWebhook
+{
+public:
+	CTBotWebhook();
+	~CTBotWebhook();
+
+	// start the HTTP listener
+	// params
+	//   port       : the TCP port
+	//   path       : the request path accepted, i.e. "/" or "/telegram"
+	//   secretToken: if not empty, the requests must contain the same X-Telegram-Bot-Api-Secret-Token header
+	// returns
+	//   true if no error occurred
+	bool begin(uint16_t port, const String& path, const String& secretToken);
+
+	// stop the HTTP listener and clear the queue
+	void end(void);
+
+	// check if the HTTP listener is running
+	bool isRunning(void);
+
+	// handle a pending connection, if any. Without a pending connection it returns immediately
+	void handleClient(void);
+
+	// handle a single HTTP request: read it from the stream, queue the update and write the response.
+	// Any stream can be used: i.e. the requests recorded in a file
+	// params
+	//   client: the stream connected to the HTTP client
+	// returns
+	//   the HTTP status code of the response (200 -> the update is queued)
+	uint16_t handleRequest(Stream& client);
+
+	// get the number of queued updates
+	uint8_t getCount(void);
+
+	// remove the oldest update from the queue
+	// params
+	//   update: will contain the update JSON
+	// returns
+	//   true if an update was available
+	bool pop(String& update);
+
+	// get the number of updates received (queued) since begin()
+	uint32_t getReceived(void);
+
+	// get the number of requests refused (wrong path or token, too big, queue full...) since begin()
+	uint32_t getRejected(void);
+
+private:
+	WiFiServer*         m_server;
+	CTBotWebhookHandler m_handler;
+};
+
+#endif
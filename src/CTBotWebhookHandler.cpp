@@ -0,0 +1,159 @@
+#include "CTBotWebhookHandler.h"
+#include "Utilities.h"
+
+CTBotWebhookHandler::CTBotWebhookHandler() {
+	m_head     = 0;
+	m_count    = 0;
+	m_received = 0;
+	m_rejected = 0;
+}
+
+void CTBotWebhookHandler::begin(const String& path, const String& secretToken) {
+	clear();
+	m_path        = path;
+	m_secretToken = secretToken;
+	m_received    = 0;
+	m_rejected    = 0;
+}
+
+void CTBotWebhookHandler::clear(void) {
+	for (uint8_t i = 0; i < CTBOT_WEBHOOK_QUEUE_SIZE; i++)
+		m_queue[i] = "";
+	m_head  = 0;
+	m_count = 0;
+}
+
+uint16_t CTBotWebhookHandler::handleRequest(Stream& client) {
+	uint32_t deadline = millis() + CTBOT_WEBHOOK_READ_TIMEOUT;
+	String line;
+
+	// request line: POST <path> HTTP/1.1
+	if (!readLine(client, line, deadline))
+		return(sendResponse(client, 408));
+	int pathStart = line.indexOf(' ');
+	int pathEnd   = line.indexOf(' ', pathStart + 1);
+	if ((pathStart < 0) || (pathEnd < 0))
+		return(sendResponse(client, 400));
+	if (line.substring(0, pathStart) != FSTR("POST"))
+		return(sendResponse(client, 405));
+	String path = line.substring(pathStart + 1, pathEnd);
+	if (path.indexOf('?') >= 0)
+		path = path.substring(0, path.indexOf('?'));
+	if (path != m_path)
+		return(sendResponse(client, 404));
+
+	// headers
+	uint32_t contentLength = 0;
+	bool authorized = (0 == m_secretToken.length());
+	while (true) {
+		if (!readLine(client, line, deadline))
+			return(sendResponse(client, 408));
+		if (0 == line.length())
+			break;
+		int colon = line.indexOf(':');
+		if (colon < 0)
+			continue;
+		String name  = line.substring(0, colon);
+		String value = line.substring(colon + 1);
+		name.toLowerCase();
+		value.trim();
+		if (name == FSTR("content-length"))
+			contentLength = value.toInt();
+		else if ((name == FSTR("x-telegram-bot-api-secret-token")) && (m_secretToken.length() != 0))
+			authorized = (value == m_secretToken); // without a secret the header is ignored
+	}
+	if (!authorized)
+		return(sendResponse(client, 401));
+	if (0 == contentLength)
+		return(sendResponse(client, 411));
+	if (contentLength > CTBOT_WEBHOOK_MAX_BODY)
+		return(sendResponse(client, 413));
+	// the Telegram server sends the update again later
+	if (CTBOT_WEBHOOK_QUEUE_SIZE == m_count)
+		return(sendResponse(client, 503));
+
+	// body: the update JSON
+	String body;
+	if (!body.reserve(contentLength))
+		return(sendResponse(client, 503));
+	while (body.length() < contentLength) {
+		if ((int32_t)(millis() - deadline) >= 0)
+			return(sendResponse(client, 408));
+		int c = client.read();
+		if (c < 0) {
+			delay(1);
+			continue;
+		}
+		body += (char)c;
+	}
+
+	m_queue[(m_head + m_count) % CTBOT_WEBHOOK_QUEUE_SIZE] = body;
+	m_count++;
+	m_received++;
+	return(sendResponse(client, 200));
+}
+
+uint8_t CTBotWebhookHandler::getCount(void) {
+	return(m_count);
+}
+
+bool CTBotWebhookHandler::pop(String& update) {
+	if (0 == m_count)
+		return false;
+	update = m_queue[m_head];
+	m_queue[m_head] = "";
+	m_head = (m_head + 1) % CTBOT_WEBHOOK_QUEUE_SIZE;
+	m_count--;
+	return true;
+}
+
+uint32_t CTBotWebhookHandler::getReceived(void) {
+	return(m_received);
+}
+
+uint32_t CTBotWebhookHandler::getRejected(void) {
+	return(m_rejected);
+}
+
+bool CTBotWebhookHandler::readLine(Stream& client, String& line, uint32_t deadline) {
+	line = "";
+	while ((int32_t)(millis() - deadline) < 0) {
+		int c = client.read();
+		if (c < 0) {
+			delay(1);
+			continue;
+		}
+		if ('\n' == c)
+			return true;
+		if (c != '\r') {
+			// a request line or header longer than the body limit is not an update
+			if (line.length() >= CTBOT_WEBHOOK_MAX_BODY)
+				return false;
+			line += (char)c;
+		}
+	}
+	return false;
+}
+
+uint16_t CTBotWebhookHandler::sendResponse(Stream& client, uint16_t code) {
+	const char* reason;
+	switch (code) {
+	case 200: reason = "OK"; break;
+	case 400: reason = "Bad Request"; break;
+	case 401: reason = "Unauthorized"; break;
+	case 404: reason = "Not Found"; break;
+	case 405: reason = "Method Not Allowed"; break;
+	case 408: reason = "Request Timeout"; break;
+	case 411: reason = "Length Required"; break;
+	case 413: reason = "Payload Too Large"; break;
+	default:  reason = "Service Unavailable"; break;
+	}
+	if (code != 200) {
+		m_rejected++;
+		String message = (String)FSTR("--- Webhook: request refused, ") + (String)code + (String)"\n";
+		serialLog(message, CTBOT_DEBUG_CONNECTION);
+	}
+	client.print((String)FSTR("HTTP/1.1 ") + (String)code + (String)" " + (String)reason +
+		(String)FSTR("\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"));
+	return(code);
+}
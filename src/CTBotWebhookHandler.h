@@ -0,0 +1,76 @@
+#pragma once
+#ifndef CTBOT_WEBHOOK_HANDLER
+#define CTBOT_WEBHOOK_HANDLER
+
+#include <Arduino.h>
+#include "CTBotDefines.h"
+
+// webhook request handler: parses the HTTP requests POSTed by the Telegram server and queues their
+// JSON bodies. It only needs a Stream, so it is independent of the network stack (the listener is
+// CTBotWebhook) and it can be built and tested on a PC (extras/test)
+class CTBotWebhookHandler
+{
+public:
+	CTBotWebhookHandler();
+
+	// set the accepted requests, clear the queue and the counters
+	// params
+	//   path       : the request path accepted, i.e. "/" or "/telegram"
+	//   secretToken: if not empty, the requests must contain the same X-Telegram-Bot-Api-Secret-Token header
+	void begin(const String& path, const String& secretToken);
+
+	// clear the queue
+	void clear(void);
+
+	// handle a single HTTP request: read it from the stream, queue the update and write the response.
+	// Any stream can be used: i.e. a TCP client or the requests recorded in a file
+	// params
+	//   client: the stream connected to the HTTP client
+	// returns
+	//   the HTTP status code of the response (200 -> the update is queued)
+	uint16_t handleRequest(Stream& client);
+
+	// get the number of queued updates
+	uint8_t getCount(void);
+
+	// remove the oldest update from the queue
+	// params
+	//   update: will contain the update JSON
+	// returns
+	//   true if an update was available
+	bool pop(String& update);
+
+	// get the number of updates received (queued) since begin()
+	uint32_t getReceived(void);
+
+	// get the number of requests refused (wrong path or token, too big, queue full...) since begin()
+	uint32_t getRejected(void);
+
+private:
+	String   m_path;
+	String   m_secretToken;
+	String   m_queue[CTBOT_WEBHOOK_QUEUE_SIZE];
+	uint8_t  m_head;      // oldest queued update
+	uint8_t  m_count;     // queued updates
+	uint32_t m_received;
+	uint32_t m_rejected;
+
+	// read a request line, without the line terminator
+	// params
+	//   client  : the stream connected to the HTTP client
+	//   line    : will contain the line
+	//   deadline: millis() when the request reading expires
+	// returns
+	//   true if a whole line was read
+	static bool readLine(Stream& client, String& line, uint32_t deadline);
+
+	// write a response without body
+	// params
+	//   client: the stream connected to the HTTP client
+	//   code  : the HTTP status code
+	// returns
+	//   the HTTP status code
+	uint16_t sendResponse(Stream& client, uint16_t code);
+};
+
+#endif
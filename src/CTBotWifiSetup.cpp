@@ -7,10 +7,83 @@
 #include <WiFi.h>
 #endif
 
+// last connected access point and DHCP lease, kept in the RTC memory across deep sleeps and resets
+struct CTBotWifiCache {
+	uint32_t magic;
+	uint32_t network;  // network credentials hash
+	uint32_t ip;
+	uint32_t gateway;
+	uint32_t subnet;
+	uint32_t dns1;
+	uint32_t dns2;
+	uint8_t  bssid[6];
+	uint8_t  channel;
+	uint8_t  reserved;
+	uint32_t checksum; // the RTC memory content is random after a power on
+};
+
+#define CTBOT_WIFI_CACHE_MAGIC 0x43544257UL
+
+// scan result of a known network not found
+#define CTBOT_WIFI_NO_SIGNAL (-128)
+
+#if defined(ARDUINO_ARCH_ESP32) // ESP32
+static RTC_NOINIT_ATTR CTBotWifiCache rtcWifiCache;
+#endif
+
+static uint32_t cacheChecksum(const CTBotWifiCache& cache) {
+	const uint8_t* data = (const uint8_t*)&cache;
+	uint32_t hash = 2166136261UL;
+	for (uint8_t i = 0; i < offsetof(CTBotWifiCache, checksum); i++) {
+		hash ^= data[i];
+		hash *= 16777619UL;
+	}
+	return(hash);
+}
+
+static bool loadWifiCache(CTBotWifiCache& cache) {
+#if defined(ARDUINO_ARCH_ESP8266) // ESP8266
+	if (!ESP.rtcUserMemoryRead(CTBOT_WIFI_RTC_OFFSET, (uint32_t*)&cache, sizeof(cache)))
+		return false;
+#elif defined(ARDUINO_ARCH_ESP32) // ESP32
+	memcpy(&cache, &rtcWifiCache, sizeof(cache));
+#endif
+	return((CTBOT_WIFI_CACHE_MAGIC == cache.magic) && (cacheChecksum(cache) == cache.checksum));
+}
+
+static void storeWifiCache(CTBotWifiCache& cache) {
+	cache.checksum = cacheChecksum(cache);
+#if defined(ARDUINO_ARCH_ESP8266) // ESP8266
+	ESP.rtcUserMemoryWrite(CTBOT_WIFI_RTC_OFFSET, (uint32_t*)&cache, sizeof(cache));
+#elif defined(ARDUINO_ARCH_ESP32) // ESP32
+	memcpy(&rtcWifiCache, &cache, sizeof(cache));
+#endif
+}
+
+static void clearWifiCache() {
+	CTBotWifiCache cache;
+	memset(&cache, 0, sizeof(cache));
+	storeWifiCache(cache);
+}
+
 CTBotWifiSetup::CTBotWifiSetup() {
 	m_wifiConnectionTries = 0;
 	m_SSID = "";
 	m_password = "";
+	m_staticIP = false;
+	memset(&m_stats, 0, sizeof(m_stats));
+	m_networkCount = 0;
+	m_scanTime     = 0;
+	m_scanValid    = false;
+	m_freshScan    = false;
+	m_roaming      = false;
+	m_state        = CTBotWifiIdle;
+	m_stateTime    = millis();
+	m_backoff      = CTBOT_WIFI_BACKOFF_MIN;
+	m_downSince    = 0;
+	m_roamTime     = 0;
+	m_tried        = 0;
+	m_current      = -1;
 }
 
 CTBotWifiSetup::~CTBotWifiSetup() {
@@ -36,6 +109,291 @@ bool CTBotWifiSetup::reconnect() {
 	return wifiConnect(m_SSID, m_password);
 }
 
+CTBotWifiStats CTBotWifiSetup::getStats() {
+	return(m_stats);
+}
+
+bool CTBotWifiSetup::addNetwork(const String& ssid, const String& password, uint8_t priority) {
+	if ((0 == ssid.length()) || (m_networkCount >= CTBOT_WIFI_MAX_NETWORKS))
+		return false;
+	m_netSSID[m_networkCount]     = ssid;
+	m_netPassword[m_networkCount] = password;
+	m_netPriority[m_networkCount] = priority;
+	m_scanRSSI[m_networkCount]    = CTBOT_WIFI_NO_SIGNAL;
+	m_networkCount++;
+	m_scanValid = false; // the new network isn't in the last scan results
+	return true;
+}
+
+void CTBotWifiSetup::clearNetworks() {
+	for (uint8_t i = 0; i < m_networkCount; i++) {
+		m_netSSID[i]     = "";
+		m_netPassword[i] = "";
+	}
+	m_networkCount = 0;
+	m_scanValid    = false;
+	m_current      = -1;
+	setState(CTBotWifiIdle);
+}
+
+bool CTBotWifiSetup::hasNetworks() {
+	return(m_networkCount > 0);
+}
+
+CTBotWifiState CTBotWifiSetup::handleConnection() {
+	if (0 == m_networkCount)
+		return CTBotWifiIdle;
+
+	switch (m_state) {
+	case CTBotWifiIdle:
+		// the manager drives the reconnections: no SDK auto reconnect and no flash writes on every WiFi.begin()
+		WiFi.persistent(false);
+		WiFi.setAutoReconnect(false);
+#if CTBOT_STATION_MODE > 0
+		if (WiFi.getMode() != WIFI_STA)
+			WiFi.mode(WIFI_STA);
+#else
+		if (WiFi.getMode() != WIFI_AP_STA)
+			WiFi.mode(WIFI_AP_STA);
+#endif
+		startRound();
+		break;
+
+	case CTBotWifiScanning: {
+		int16_t count = WiFi.scanComplete();
+		if (WIFI_SCAN_RUNNING == count) {
+			if ((millis() - m_stateTime) < CTBOT_WIFI_CONNECT_TIMEOUT)
+				break;
+			count = WIFI_SCAN_FAILED;
+		}
+		if (count < 0) {
+			serialLog(FSTR("--- handleConnection: scan failed\n"), CTBOT_DEBUG_WIFI);
+			WiFi.scanDelete();
+			count = 0;
+		}
+		readScanResults(count);
+
+		if (m_roaming) {
+			m_roaming = false;
+			if (WiFi.status() == WL_CONNECTED) {
+				// switch only to a higher priority network or to a much stronger access point
+				m_tried = 0;
+				int8_t best = selectNetwork();
+				if ((best >= 0) && (m_current >= 0) && (memcmp(m_scanBSSID[best], WiFi.BSSID(), 6) != 0) &&
+					((m_netPriority[best] > m_netPriority[m_current]) ||
+					((m_netPriority[best] == m_netPriority[m_current]) && (m_scanRSSI[best] >= WiFi.RSSI() + CTBOT_WIFI_ROAM_HYSTERESIS)))) {
+					String message = (String)FSTR("Switching to a better access point of ") + m_netSSID[best] + (String)"\n";
+					serialLog(message, CTBOT_DEBUG_WIFI);
+					m_stats.roams++;
+					m_downSince = millis();
+					m_tried = 0;
+					connectNetwork(best);
+				}
+				else
+					setState(CTBotWifiConnected);
+				break;
+			}
+			// the connection was lost during the scan
+			m_downSince = millis();
+			m_tried = 0;
+		}
+		connectNext();
+		break;
+	}
+
+	case CTBotWifiConnecting: {
+		wl_status_t status = WiFi.status();
+		if (WL_CONNECTED == status)
+			onConnected();
+		else if ((WL_CONNECT_FAILED == status) || (WL_NO_SSID_AVAIL == status) ||
+			((millis() - m_stateTime) >= CTBOT_WIFI_CONNECT_TIMEOUT)) {
+			String message = (String)FSTR("--- handleConnection: unable to connect to ") + m_netSSID[m_current] + (String)"\n";
+			serialLog(message, CTBOT_DEBUG_WIFI);
+			m_stats.failures++;
+			WiFi.disconnect();
+			connectNext();
+		}
+		break;
+	}
+
+	case CTBotWifiConnected:
+		if (WiFi.status() != WL_CONNECTED) {
+			serialLog(FSTR("--- handleConnection: connection lost\n"), CTBOT_DEBUG_WIFI);
+#if defined(ARDUINO_ARCH_ESP8266) // ESP8266
+			m_statusPin.setValue(HIGH);
+#elif defined(ARDUINO_ARCH_ESP32) // ESP32
+			m_statusPin.setValue(LOW);
+#endif
+			m_downSince = millis();
+			m_backoff   = CTBOT_WIFI_BACKOFF_MIN;
+			// the cached scan results put the same access point first: usually a short glitch
+			startRound();
+		}
+		else if ((millis() - m_roamTime) >= CTBOT_WIFI_ROAM_INTERVAL) {
+			m_roamTime = millis();
+			bool higherPriority = false;
+			for (uint8_t i = 0; i < m_networkCount; i++)
+				if ((m_current >= 0) && (m_netPriority[i] > m_netPriority[m_current]))
+					higherPriority = true;
+			if (higherPriority || (WiFi.RSSI() < CTBOT_WIFI_ROAM_RSSI)) {
+				// scan while connected: the connection keeps working
+				m_roaming = true;
+				startScan();
+			}
+		}
+		break;
+
+	case CTBotWifiBackoff:
+		if ((millis() - m_stateTime) >= m_backoff) {
+			m_backoff = (m_backoff >= CTBOT_WIFI_BACKOFF_MAX / 2) ? CTBOT_WIFI_BACKOFF_MAX : m_backoff * 2;
+			m_scanValid = false;
+			startRound();
+		}
+		break;
+	}
+	return(m_state);
+}
+
+void CTBotWifiSetup::setState(CTBotWifiState state) {
+	m_state     = state;
+	m_stateTime = millis();
+}
+
+void CTBotWifiSetup::startRound() {
+	m_tried     = 0;
+	m_freshScan = false;
+	if (m_scanValid && ((millis() - m_scanTime) < CTBOT_WIFI_SCAN_TTL))
+		connectNext();
+	else
+		startScan();
+}
+
+void CTBotWifiSetup::startScan() {
+	WiFi.scanNetworks(true);
+	setState(CTBotWifiScanning);
+}
+
+void CTBotWifiSetup::readScanResults(int16_t count) {
+	for (uint8_t i = 0; i < m_networkCount; i++)
+		m_scanRSSI[i] = CTBOT_WIFI_NO_SIGNAL;
+
+	// keep the strongest access point of every known network
+	for (int16_t j = 0; j < count; j++) {
+		String ssid = WiFi.SSID(j);
+		int32_t rssi = WiFi.RSSI(j);
+		for (uint8_t i = 0; i < m_networkCount; i++) {
+			if ((m_netSSID[i] == ssid) && (rssi > m_scanRSSI[i])) {
+				m_scanRSSI[i]    = (int8_t)rssi;
+				m_scanChannel[i] = (uint8_t)WiFi.channel(j);
+				memcpy(m_scanBSSID[i], WiFi.BSSID(j), 6);
+			}
+		}
+	}
+	WiFi.scanDelete();
+
+	m_scanTime  = millis();
+	m_scanValid = true;
+	m_freshScan = true;
+}
+
+int8_t CTBotWifiSetup::selectNetwork() {
+	int8_t best = -1;
+	for (uint8_t i = 0; i < m_networkCount; i++) {
+		if ((m_tried & (1 << i)) || (CTBOT_WIFI_NO_SIGNAL == m_scanRSSI[i]))
+			continue;
+		if ((best < 0) || (m_netPriority[i] > m_netPriority[best]) ||
+			((m_netPriority[i] == m_netPriority[best]) && (m_scanRSSI[i] > m_scanRSSI[best])))
+			best = i;
+	}
+	return(best);
+}
+
+void CTBotWifiSetup::connectNext() {
+	int8_t next = selectNetwork();
+	if (next >= 0) {
+		connectNetwork(next);
+		return;
+	}
+	if (!m_freshScan) {
+		// the cached results are exhausted: the access points could be changed
+		startScan();
+		return;
+	}
+	String message = (String)FSTR("--- handleConnection: no network available, retry in ") + (String)m_backoff + (String)FSTR(" ms\n");
+	serialLog(message, CTBOT_DEBUG_WIFI);
+	m_current = -1;
+	setState(CTBotWifiBackoff);
+}
+
+void CTBotWifiSetup::connectNetwork(int8_t index) {
+	String message = (String)FSTR("Connecting Wifi: ") + m_netSSID[index] + (String)"\n";
+	serialLog(message, CTBOT_DEBUG_WIFI);
+	m_tried  |= (1 << index);
+	m_current = index;
+	WiFi.begin(m_netSSID[index].c_str(), m_netPassword[index].c_str(), m_scanChannel[index], m_scanBSSID[index]);
+	setState(CTBotWifiConnecting);
+}
+
+void CTBotWifiSetup::onConnected() {
+	String message = (String)FSTR("WiFi connected to ") + m_netSSID[m_current] + (String)FSTR("\nIP address: ") + WiFi.localIP().toString() + (String)"\n";
+	serialLog(message, CTBOT_DEBUG_WIFI);
+
+	if (m_downSince != 0) {
+		uint32_t downtime = millis() - m_downSince;
+		m_stats.incidents++;
+		m_stats.lastDowntime   = downtime;
+		m_stats.totalDowntime += downtime;
+		if (downtime > m_stats.maxDowntime)
+			m_stats.maxDowntime = downtime;
+		m_downSince = 0;
+		message = (String)FSTR("Connection restored after ") + (String)downtime + (String)FSTR(" ms\n");
+		serialLog(message, CTBOT_DEBUG_WIFI);
+	}
+
+#if defined(ARDUINO_ARCH_ESP8266) // ESP8266
+	m_statusPin.setValue(LOW);
+#elif defined(ARDUINO_ARCH_ESP32) // ESP32
+	m_statusPin.setValue(HIGH);
+#endif
+
+	m_stats.connects++;
+	m_stats.fastPath = false;
+	m_stats.channel  = WiFi.channel();
+	m_stats.rssi     = WiFi.RSSI();
+	m_SSID     = m_netSSID[m_current];
+	m_password = m_netPassword[m_current];
+	m_backoff  = CTBOT_WIFI_BACKOFF_MIN;
+	m_roamTime = millis();
+	setState(CTBotWifiConnected);
+}
+
+uint32_t CTBotWifiSetup::networkHash(const String& ssid, const String& password) {
+	String credentials = ssid + (String)"\n" + password;
+	uint32_t hash = 2166136261UL;
+	for (uint16_t i = 0; i < credentials.length(); i++) {
+		hash ^= (uint8_t)credentials[i];
+		hash *= 16777619UL;
+	}
+	return(hash);
+}
+
+bool CTBotWifiSetup::waitConnection(uint32_t timeout) {
+	uint32_t startTime = millis();
+	uint32_t blinkTime = startTime;
+	while (WiFi.status() != WL_CONNECTED) {
+		if ((timeout > 0) && ((millis() - startTime) >= timeout))
+			return false;
+		// same blinking and progress dots of the old 500 ms polling
+		if ((millis() - blinkTime) >= 500) {
+			serialLog(".", CTBOT_DEBUG_WIFI);
+			m_statusPin.toggle();
+			blinkTime += 500;
+		}
+		delay(CTBOT_WIFI_POLL_INTERVAL);
+	}
+	return true;
+}
+
 void CTBotWifiSetup::setStatusPin(int8_t pin) {
 	m_statusPin.setPin(pin);
 }
@@ -68,6 +426,7 @@ bool CTBotWifiSetup::setIP(const String& ip, const String& gateway, const String
 		}
 	}
 	if (WiFi.config(IP, GW, SN, DNS1, DNS2)) {
+		m_staticIP = true;
 		IPAddress ip = WiFi.localIP();
 		String message = (String)FSTR("New IP address: ") + ip.toString() + (String)"\n";
 		serialLog(message, CTBOT_DEBUG_WIFI);
@@ -84,38 +443,80 @@ bool CTBotWifiSetup::wifiConnect(const String& ssid, const String& password) {
 		return false;
 
 	// attempt to connect to Wifi network:
-	int tries = 0;
+	uint32_t startTime = millis();
 	String message;
 	message = (String)FSTR("\n\nConnecting Wifi: ") + ssid + (String)"\n";
 	serialLog(message, CTBOT_DEBUG_WIFI);
 
+	// changing the mode restarts the radio: do it only if needed
 #if CTBOT_STATION_MODE > 0
-	WiFi.mode(WIFI_STA);
+	if (WiFi.getMode() != WIFI_STA)
+		WiFi.mode(WIFI_STA);
 #else
-	WiFi.mode(WIFI_AP_STA);
+	if (WiFi.getMode() != WIFI_AP_STA)
+		WiFi.mode(WIFI_AP_STA);
 #endif
-	delay(500);
-
-	WiFi.begin(ssid.c_str(), password.c_str());
-	delay(500);
-
-	if (0 == m_wifiConnectionTries)
-		tries = -1;
-
-	while ((WiFi.status() != WL_CONNECTED) && (tries < m_wifiConnectionTries)) {
-		serialLog(".", CTBOT_DEBUG_WIFI);
 
-		m_statusPin.toggle();
+	// fast path: connect to the cached access point, no scan and no DHCP exchange
+	CTBotWifiCache cache;
+	uint32_t network = networkHash(ssid, password);
+	bool connected = false;
+	m_stats.fastPath = false;
+	if (loadWifiCache(cache) && (cache.network == network)) {
+		serialLog(FSTR("Fast reconnect to the cached access point\n"), CTBOT_DEBUG_WIFI);
+#if CTBOT_WIFI_REUSE_IP > 0
+		if (!m_staticIP)
+			WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway), IPAddress(cache.subnet), IPAddress(cache.dns1), IPAddress(cache.dns2));
+#endif
+		WiFi.begin(ssid.c_str(), password.c_str(), cache.channel, cache.bssid);
+		connected = waitConnection(CTBOT_WIFI_FAST_TIMEOUT);
+		if (connected)
+			m_stats.fastPath = true;
+		else {
+			// the access point moved or the lease expired: forget them and make a full connection
+			serialLog(FSTR("\nFast reconnect failed, scanning\n"), CTBOT_DEBUG_WIFI);
+			m_stats.fastFailures++;
+			clearWifiCache();
+			WiFi.disconnect();
+#if CTBOT_WIFI_REUSE_IP > 0
+			if (!m_staticIP)
+				WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0)); // back to DHCP
+#endif
+		}
+	}
 
-		delay(500);
-		if (m_wifiConnectionTries != 0) tries++;
+	if (!connected) {
+		WiFi.begin(ssid.c_str(), password.c_str());
+		// m_wifiConnectionTries counts the old 500 ms polling steps (zero -> infinite)
+		waitConnection((0 == m_wifiConnectionTries) ? 0 : ((uint32_t)m_wifiConnectionTries + 1) * 500);
 	}
+	m_stats.connectTime = millis() - startTime;
 
 	if (WiFi.status() == WL_CONNECTED) {
 		IPAddress ip = WiFi.localIP();
-		message = (String)FSTR("\nWiFi connected\nIP address: ") + ip.toString() + (String)"\n";
+		message = (String)FSTR("\nWiFi connected\nIP address: ") + ip.toString() + (String)FSTR("\nConnection time: ") +
+			(String)m_stats.connectTime + (String)FSTR(" ms\n");
 		serialLog(message, CTBOT_DEBUG_WIFI);
 
+		m_stats.connects++;
+		if (m_stats.fastPath)
+			m_stats.fastConnects++;
+		m_stats.channel = WiFi.channel();
+		m_stats.rssi    = WiFi.RSSI();
+
+		// cache the access point and the DHCP lease for the next connection
+		cache.magic    = CTBOT_WIFI_CACHE_MAGIC;
+		cache.network  = network;
+		cache.ip       = (uint32_t)WiFi.localIP();
+		cache.gateway  = (uint32_t)WiFi.gatewayIP();
+		cache.subnet   = (uint32_t)WiFi.subnetMask();
+		cache.dns1     = (uint32_t)WiFi.dnsIP(0);
+		cache.dns2     = (uint32_t)WiFi.dnsIP(1);
+		memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+		cache.channel  = m_stats.channel;
+		cache.reserved = 0;
+		storeWifiCache(cache);
+
 #if defined(ARDUINO_ARCH_ESP8266) // ESP8266
 		m_statusPin.setValue(LOW);
 #elif defined(ARDUINO_ARCH_ESP32) // ESP32
@@ -130,6 +531,7 @@ bool CTBotWifiSetup::wifiConnect(const String& ssid, const String& password) {
 	else {
 		message = (String)FSTR("\nUnable to connect to ") + ssid + (String)FSTR(" network.\n");
 		serialLog(message, CTBOT_DEBUG_WIFI);
+		m_stats.failures++;
 
 #if defined(ARDUINO_ARCH_ESP8266) // ESP8266
 		m_statusPin.setValue(HIGH);
@@ -4,8 +4,18 @@
 
 #include <Arduino.h>
 #include "CTBotStatusPin.h"
+#include "CTBotMetrics.h"
 #include "CTBotDefines.h"
 
+// states of the non blocking connection manager (CTBotWifiSetup::handleConnection())
+enum CTBotWifiState {
+	CTBotWifiIdle       = 0, // no networks added
+	CTBotWifiScanning   = 1, // looking for the known networks
+	CTBotWifiConnecting = 2, // connecting to an access point
+	CTBotWifiConnected  = 3, // connected
+	CTBotWifiBackoff    = 4  // all the known networks failed, waiting before the next round
+};
+
 class CTBotWifiSetup
 {
 public:
@@ -34,7 +44,10 @@ public:
 	//   true if no error occurred
 	bool setIP(const String& ip, const String& gateway, const String& subnetMask, const String& dns1 = "", const String& dns2 = "");
 
-	// connect to a wifi network
+	// connect to a wifi network. The access point (BSSID and channel) and the DHCP lease of the last
+	// connection are cached in the RTC memory, so a reconnection to the same network (i.e. after
+	// a deep sleep) skips the scan and the DHCP exchange. If the fast reconnection fails in
+	// CTBOT_WIFI_FAST_TIMEOUT milliseconds, a full connection is made
 	// params
 	//   ssid    : the SSID network identifier
 	//   password: the optional password
@@ -59,11 +72,102 @@ public:
 	//   true if no error occurred
 	bool reconnect();
 
+	// add a network to the non blocking connection manager (see handleConnection())
+	// params
+	//   ssid    : the SSID network identifier
+	//   password: the optional password
+	//   priority: the network rank: the available network with the highest priority is used,
+	//             networks with the same priority are ranked by signal strength
+	// returns
+	//   true if no error occurred (less than CTBOT_WIFI_MAX_NETWORKS networks)
+	bool addNetwork(const String& ssid, const String& password = "", uint8_t priority = 0);
+
+	// remove all the networks of the connection manager
+	void clearNetworks();
+
+	// check if the connection manager has some networks
+	bool hasNetworks();
+
+	// advance the non blocking connection manager: it never waits, so call it from the poll loop.
+	// It scans for the known networks (the results are reused for CTBOT_WIFI_SCAN_TTL ms), connects
+	// to the best one, falls back to the next ones, waits with an exponential backoff when all of
+	// them fail and switches to a better access point when the signal is weak
+	// returns
+	//   the connection manager state (CTBotWifiConnected -> the WiFi connection is established)
+	CTBotWifiState handleConnection();
+
+	// get the statistics of the WiFi connections (duration of the last one, fast reconnections...)
+	// returns
+	//   the WiFi connection statistics
+	CTBotWifiStats getStats();
+
 private:
 	uint8_t         m_wifiConnectionTries;
 	CTBotStatusPin  m_statusPin;
 	String          m_SSID;
 	String          m_password;
+	bool            m_staticIP;  // true if setIP() was used: don't touch the IP configuration
+	CTBotWifiStats  m_stats;
+
+	// connection manager: known networks
+	String          m_netSSID[CTBOT_WIFI_MAX_NETWORKS];
+	String          m_netPassword[CTBOT_WIFI_MAX_NETWORKS];
+	uint8_t         m_netPriority[CTBOT_WIFI_MAX_NETWORKS];
+	uint8_t         m_networkCount;
+	// connection manager: best access point of every known network found by the last scan
+	int8_t          m_scanRSSI[CTBOT_WIFI_MAX_NETWORKS]; // CTBOT_WIFI_NO_SIGNAL -> not found
+	uint8_t         m_scanBSSID[CTBOT_WIFI_MAX_NETWORKS][6];
+	uint8_t         m_scanChannel[CTBOT_WIFI_MAX_NETWORKS];
+	uint32_t        m_scanTime;     // millis() of the last scan
+	bool            m_scanValid;
+	bool            m_freshScan;    // a scan was made during the current connection round
+	bool            m_roaming;      // the running scan looks for a better access point
+	// connection manager: state
+	CTBotWifiState  m_state;
+	uint32_t        m_stateTime;    // millis() of the last state change
+	uint32_t        m_backoff;      // current backoff pause, in milliseconds
+	uint32_t        m_downSince;    // millis() of the connection loss, zero if no loss is in progress
+	uint32_t        m_roamTime;     // millis() of the last better access point check
+	uint8_t         m_tried;        // bit mask of the networks tried in the current round
+	int8_t          m_current;      // network used by the connection, -1 if none
+
+	// wait until the WiFi connection is established, blinking the status pin
+	// params
+	//   timeout: max waiting time, in milliseconds. Zero means no timeout
+	// returns
+	//   true if the connection is established
+	bool waitConnection(uint32_t timeout);
+
+	// connection manager: set the state
+	void setState(CTBotWifiState state);
+
+	// connection manager: start a connection round (scan if the results are too old)
+	void startRound();
+
+	// connection manager: start an asynchronous scan
+	void startScan();
+
+	// connection manager: store the scan results of the known networks
+	void readScanResults(int16_t count);
+
+	// connection manager: connect to the best network not tried yet in the current round,
+	// scan again or back off if none is left
+	void connectNext();
+
+	// connection manager: connect to a known network, using the scanned access point
+	void connectNetwork(int8_t index);
+
+	// connection manager: the connection is established
+	void onConnected();
+
+	// connection manager: get the best network not tried yet in the current round
+	// returns
+	//   the network index, -1 if none
+	int8_t selectNetwork();
+
+	// hash the network credentials, so the cached access point is used only for the same network
+	// and the password is not stored
+	static uint32_t networkHash(const String& ssid, const String& password);
 };
 
 #endif
\ No newline at end of file
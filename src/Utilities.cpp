@@ -70,17 +70,29 @@ String int64ToAscii(int64_t value) {
 	return buffer;
 }
 
-String URLEncodeMessage(String message) {
+// true if a byte doesn't need to be URL encoded
+static bool isURLSafe(uint8_t value) {
+	return(((value >= 0x30) && (value <= 0x39)) || // numbers
+		((value >= 0x41) && (value <= 0x5A)) ||     // caps letters
+		((value >= 0x61) && (value <= 0x7A)));      // letters
+}
+
+String URLEncodeMessage(const String& message) {
+	return(URLEncodeMessage(message, 0, message.length()));
+}
+
+String URLEncodeMessage(const String& message, uint32_t start, uint32_t end) {
 	String encodedMessage = "";
 	char buffer[4];
 	buffer[0] = '%';
 	buffer[3] = 0x00;
-	uint16_t i;
-	for (i = 0; i < message.length(); i++) {
-		if (((message[i] >= 0x30) && (message[i] <= 0x39)) || // numbers
-			((message[i] >= 0x41) && (message[i] <= 0x5A)) || // caps letters
-			((message[i] >= 0x61) && (message[i] <= 0x7A)))   // letters
-			encodedMessage += (String)message[i];
+	uint32_t i;
+	if (end > message.length())
+		end = message.length();
+	encodedMessage.reserve(end > start ? end - start : 0);
+	for (i = start; i < end; i++) {
+		if (isURLSafe(message[i]))
+			encodedMessage += (char)message[i];
 		else {
 			buffer[1] = message[i] >> 4;
 			if (buffer[1] <= 0x09)
@@ -99,3 +111,114 @@ String URLEncodeMessage(String message) {
 	return encodedMessage ;
 }
 
+uint32_t getMessageChunkEnd(const String& message, uint32_t start, uint32_t maxLength, uint32_t maxEncodedSize) {
+	uint32_t length     = message.length();
+	uint32_t characters = 0; // chunk length, in UTF-16 characters
+	uint32_t encoded    = 0; // URL encoded chunk size
+	uint32_t lineEnd    = 0; // offset after the last newline of the chunk (0 -> none)
+	uint32_t i          = start;
+
+	while (i < length) {
+		uint8_t value = message[i];
+		// UTF-8 sequence size (a stray continuation byte is taken alone)
+		uint8_t size = 1;
+		if (value >= 0xF0)
+			size = 4;
+		else if (value >= 0xE0)
+			size = 3;
+		else if (value >= 0xC0)
+			size = 2;
+		if (i + size > length)
+			size = length - i;
+		// the 4 bytes sequences are UTF-16 surrogate pairs, every non ASCII byte is URL encoded
+		uint8_t units = (4 == size) ? 2 : 1;
+		uint8_t encodedSize = isURLSafe(value) ? 1 : 3 * size;
+
+		if ((characters + units > maxLength) || (encoded + encodedSize > maxEncodedSize)) {
+			// limits too small for a single character: take it anyway, the request will fail
+			if (i == start)
+				return(start + size);
+			break;
+		}
+		characters += units;
+		encoded    += encodedSize;
+		i          += size;
+		if ('\n' == value)
+			lineEnd = i;
+	}
+
+	if (i >= length)
+		return(length);
+	// prefer the line boundary, unless the chunk gets too short
+	if ((lineEnd > start) && ((lineEnd - start) * 2 >= (i - start)))
+		return(lineEnd);
+	return(i);
+}
+
+String sendMessageParameters(int64_t id, const String& message, const String& keyboard) {
+	return(sendMessageParameters(id, message, 0, message.length(), keyboard));
+}
+
+String sendMessageParameters(int64_t id, const String& message, uint32_t start, uint32_t end, const String& keyboard) {
+	String parameters = (String)FSTR("?chat_id=") + int64ToAscii(id) + (String)FSTR("&text=") + URLEncodeMessage(message, start, end);
+	if (keyboard.length() != 0)
+		parameters += (String)FSTR("&reply_markup=") + keyboard;
+	return(parameters);
+}
+
+String editMessageTextParameters(int64_t id, int32_t messageID, const String& message, const String& keyboard) {
+	String parameters = (String)FSTR("?chat_id=") + int64ToAscii(id) + (String)FSTR("&message_id=") + (String)messageID +
+		(String)FSTR("&text=") + URLEncodeMessage(message);
+	if (keyboard.length() != 0)
+		parameters += (String)FSTR("&reply_markup=") + keyboard;
+	return(parameters);
+}
+
+String answerCallbackQueryParameters(const String& queryID, const String& message, bool alertMode) {
+	String parameters = (String)FSTR("?callback_query_id=") + queryID;
+	if (message.length() != 0) {
+		if (alertMode)
+			parameters += (String)FSTR("&text=") + URLEncodeMessage(message) + (String)FSTR("&show_alert=true");
+		else
+			parameters += (String)FSTR("&text=") + URLEncodeMessage(message) + (String)FSTR("&show_alert=false");
+	}
+	return(parameters);
+}
+
+uint32_t httpDateToUnixTime(const String& date) {
+	// "Sun, 06 Nov 1994 08:49:37 GMT"
+	//  0123456789012345678901234567
+	const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+	if ((date.length() < 29) || (date[3] != ',') || (date[19] != ':') || (date[22] != ':'))
+		return 0;
+
+	uint32_t day    = date.substring(5, 7).toInt();
+	String   name   = date.substring(8, 11);
+	uint32_t year   = date.substring(12, 16).toInt();
+	uint32_t hour   = date.substring(17, 19).toInt();
+	uint32_t minute = date.substring(20, 22).toInt();
+	uint32_t second = date.substring(23, 25).toInt();
+
+	uint32_t month = 0;
+	while ((month < 12) && (strncmp(&months[month * 3], name.c_str(), 3) != 0))
+		month++;
+	if ((month >= 12) || (year < 1970) || (day < 1) || (day > 31))
+		return 0;
+
+	// days from 1970-01-01 to the first day of the month (civil calendar, March based year)
+	uint32_t y = year - ((month < 2) ? 1 : 0);
+	uint32_t m = (month + 10) % 12; // March = 0
+	uint32_t days = 365 * y + y / 4 - y / 100 + y / 400 + (153 * m + 2) / 5 + (day - 1);
+	days -= 719468; // days from 0000-03-01 to 1970-01-01
+
+	return days * 86400 + hour * 3600 + minute * 60 + second;
+}
+
+uint32_t getMaxFreeBlockSize() {
+#if defined(ARDUINO_ARCH_ESP8266) // ESP8266
+	return ESP.getMaxFreeBlockSize();
+#elif defined(ARDUINO_ARCH_ESP32) // ESP32
+	return ESP.getMaxAllocHeap();
+#endif
+}
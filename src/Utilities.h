@@ -24,7 +24,78 @@ String int64ToAscii(int64_t value);
 //   message: the string to be encoded
 // returns
 //   the encoded string
-String URLEncodeMessage(String message);
+String URLEncodeMessage(const String& message);
+
+// encode a part of an input string to a URL (URI) compliant string, without copying it
+// params
+//   message: the string to be encoded
+//   start  : the offset of the first byte to encode
+//   end    : the offset after the last byte to encode
+// returns
+//   the encoded string
+String URLEncodeMessage(const String& message, uint32_t start, uint32_t end);
+
+// find where a message chunk ends: the chunk fits the Telegram message length and the URL size limits
+// and it is split on a line boundary (or at least on a UTF-8 character boundary)
+// params
+//   message       : the whole message
+//   start         : the offset of the chunk first byte
+//   maxLength     : the max chunk length, in UTF-16 characters (the Telegram unit)
+//   maxEncodedSize: the max URL encoded chunk size, in bytes
+// returns
+//   the offset after the chunk last byte (message.length() if the rest of the message fits)
+uint32_t getMessageChunkEnd(const String& message, uint32_t start, uint32_t maxLength, uint32_t maxEncodedSize);
+
+// build the query string of a sendMessage request
+// params
+//   id      : the telegram recipient user ID
+//   message : the message to send
+//   keyboard: the inline/reply keyboard in JSON format (empty -> no keyboard)
+// returns
+//   the query string, i.e. ?chat_id=123&text=hello
+String sendMessageParameters(int64_t id, const String& message, const String& keyboard);
+
+// build the query string of a sendMessage request with a part of a message (a chunk of a long message)
+// params
+//   id      : the telegram recipient user ID
+//   message : the whole message
+//   start   : the offset of the chunk first byte
+//   end     : the offset after the chunk last byte
+//   keyboard: the inline/reply keyboard in JSON format (empty -> no keyboard)
+// returns
+//   the query string
+String sendMessageParameters(int64_t id, const String& message, uint32_t start, uint32_t end, const String& keyboard);
+
+// build the query string of an editMessageText request
+// params
+//   id       : the telegram recipient user ID
+//   messageID: the ID of the message to be edited
+//   message  : the new text
+//   keyboard : the inline keyboard in JSON format (empty -> no keyboard)
+// returns
+//   the query string
+String editMessageTextParameters(int64_t id, int32_t messageID, const String& message, const String& keyboard);
+
+// build the query string of an answerCallbackQuery request
+// params
+//   queryID  : the unique query ID
+//   message  : an optional message (empty -> no message)
+//   alertMode: false -> a simply popup message, true -> an alert message with ok button
+// returns
+//   the query string
+String answerCallbackQueryParameters(const String& queryID, const String& message, bool alertMode);
+
+// convert an HTTP date (RFC 7231 IMF-fixdate, i.e. "Sun, 06 Nov 1994 08:49:37 GMT") to Unix time
+// params
+//   date: the HTTP date string
+// returns
+//   the Unix time (seconds since 1970-01-01 00:00:00 UTC) or zero if the date is malformed
+uint32_t httpDateToUnixTime(const String& date);
+
+// get the size of the largest free heap block (the largest allocation that can succeed)
+// returns
+//   the largest free block size, in bytes
+uint32_t getMaxFreeBlockSize();
 
 // send data to the serial port. It work only if the CTBOT_DEBUG_MODE is enabled.
 // params